@@ -120,11 +120,13 @@ IOReturn MbufUtils::zeroMbuf(mbuf_t mbuf, UInt32 from, UInt32 len) {
     
     while (bytesLeft) {
         ensure_mbuf_macro();
-        *mbufBuffer = 0;
+        // Zero all of this mbuf's part at once, rather than byte by byte
+        const size_t chunk = min_macro((size_t) bytesLeft, mbufLength);
+        memset(mbufBuffer, 0, chunk);
         
-        ++mbufBuffer;
-        --mbufLength;
-        --bytesLeft;
+        mbufBuffer += chunk;
+        mbufLength -= chunk;
+        bytesLeft -= chunk;
     }
     
     return kIOReturnSuccess;
@@ -146,12 +148,13 @@ IOReturn MbufUtils::copyFromBufferToMbuf(mbuf_t mbuf, UInt32 from, UInt32 buffer
     while (bytesLeft) {
         ensure_mbuf_macro();
         
-        *mbufBuffer = *inBuffer;
+        const size_t chunk = min_macro((size_t) bytesLeft, mbufLength);
+        memcpy(mbufBuffer, inBuffer, chunk);
         
-        ++mbufBuffer;
-        ++inBuffer;
-        --mbufLength;
-        --bytesLeft;
+        mbufBuffer += chunk;
+        inBuffer += chunk;
+        mbufLength -= chunk;
+        bytesLeft -= chunk;
     }
     
     return kIOReturnSuccess;
@@ -194,43 +197,102 @@ IOReturn MbufUtils::copyAudioFromBufferToMbuf(mbuf_t mbuf, UInt32 from, UInt32 b
     return kIOReturnSuccess;
 }
 
+// Converts a pair of samples (REAC_RESOLUTION*2 bytes) from wire order.
+static inline void copyAudioPairFromWire(const UInt8 *wirePair, UInt8 *buffer) {
+    buffer[0] = wirePair[1];
+    buffer[1] = wirePair[0];
+    buffer[2] = wirePair[3];
+    
+    buffer[3] = wirePair[2];
+    buffer[4] = wirePair[5];
+    buffer[5] = wirePair[4];
+}
+
 IOReturn MbufUtils::copyAudioFromMbufToBuffer(mbuf_t mbuf, UInt32 from, UInt32 bufferSize, UInt8 *inBuffer) {
-    if (bufferSize > (UInt32) MbufUtils::mbufTotalLength(mbuf)-from) {
+    const UInt32 pairSize = REAC_RESOLUTION*2;
+    
+    const UInt32 totalLength = (UInt32) MbufUtils::mbufTotalLength(mbuf);
+    if (from > totalLength || bufferSize > totalLength-from) {
         IOLog("MbufUtils::copyAudioFromMbufToBuffer(): Got insufficiently large buffer (mbuf too small).\n");
         return kIOReturnNoMemory;
     }
     
-    if (0 != bufferSize % (REAC_RESOLUTION*2)) {
-        IOLog("MbufUtils::copyAudioFromMbufToBuffer(): Buffer size must be a multiple of %d.\n", REAC_RESOLUTION*2);
+    if (0 != bufferSize % pairSize) {
+        IOLog("MbufUtils::copyAudioFromMbufToBuffer(): Buffer size must be a multiple of %d.\n", pairSize);
         return kIOReturnBadArgument;
     }
     
-    UInt8 *inBufferEnd = inBuffer + bufferSize;
-    UInt8 intermediaryBuffer[6];
+    if (0 == bufferSize) {
+        // Nothing to do, even if from is at the very end of the chain
+        return kIOReturnSuccess;
+    }
+    
+    UInt8 straddlingPair[REAC_RESOLUTION*2];
     UInt8 *mbufBuffer = (UInt8 *)mbuf_data(mbuf);
     size_t mbufLength = mbuf_len(mbuf);
+    UInt32 pairsLeft = bufferSize/pairSize;
+    IOReturn ret;
     
-    skip_mbuf_macro();
+    while (from >= mbufLength) {
+        from -= mbufLength;
+        if (kIOReturnSuccess != (ret = nextMbuf(&mbuf, &mbufBuffer, &mbufLength))) {
+            return ret;
+        }
+    }
+    mbufBuffer += from;
+    mbufLength -= from;
     
-    while (inBuffer < inBufferEnd) {
-        for (UInt32 i=0; i<sizeof(intermediaryBuffer); i++) {
-            ensure_mbuf_macro();
-            
-            intermediaryBuffer[i] = *mbufBuffer;
-            ++mbufBuffer;
-            --mbufLength;
+    while (pairsLeft) {
+        // The pairs that are entirely within this mbuf are converted in place
+        UInt32 pairs = mbufLength/pairSize;
+        if (pairs > pairsLeft) {
+            pairs = pairsLeft;
         }
+        for (UInt32 i=0; i<pairs; i++) {
+            copyAudioPairFromWire(mbufBuffer, inBuffer);
+            mbufBuffer += pairSize;
+            inBuffer += pairSize;
+        }
+        mbufLength -= pairs*pairSize;
+        pairsLeft -= pairs;
         
-        inBuffer[0] = intermediaryBuffer[1];
-        inBuffer[1] = intermediaryBuffer[0];
-        inBuffer[2] = intermediaryBuffer[3];
-        
-        inBuffer[3] = intermediaryBuffer[2];
-        inBuffer[4] = intermediaryBuffer[5];
-        inBuffer[5] = intermediaryBuffer[4];
+        if (0 == pairsLeft) {
+            break;
+        }
+        if (0 == mbufLength) {
+            if (kIOReturnSuccess != (ret = nextMbuf(&mbuf, &mbufBuffer, &mbufLength))) {
+                return ret;
+            }
+            continue;
+        }
         
-        inBuffer += REAC_RESOLUTION*2;
+        // The pair straddles this mbuf and the next, so it is copied out first
+        for (UInt32 i=0; i<pairSize; i++) {
+            while (0 == mbufLength) {
+                if (kIOReturnSuccess != (ret = nextMbuf(&mbuf, &mbufBuffer, &mbufLength))) {
+                    return ret;
+                }
+            }
+            straddlingPair[i] = *mbufBuffer;
+            ++mbufBuffer;
+            --mbufLength;
+        }
+        copyAudioPairFromWire(straddlingPair, inBuffer);
+        inBuffer += pairSize;
+        --pairsLeft;
     }
     
     return kIOReturnSuccess;
 }
+
+IOReturn MbufUtils::nextMbuf(mbuf_t *mbuf, UInt8 **mbufBuffer, size_t *mbufLength) {
+    *mbuf = mbuf_next(*mbuf);
+    if (!*mbuf) {
+        // This should never happen
+        IOLog("MbufUtils::nextMbuf(): Internal error (couldn't fetch next mbuf).\n");
+        return kIOReturnInternalError;
+    }
+    *mbufBuffer = (UInt8 *)mbuf_data(*mbuf);
+    *mbufLength = mbuf_len(*mbuf);
+    return kIOReturnSuccess;
+}
@@ -38,6 +38,8 @@
 class MbufUtils {
     // Returns the new size of the mbuf
     inline static size_t attemptToSetLength(mbuf_t mbuf, size_t targetLength);
+    // Moves to the next mbuf in the chain
+    static IOReturn nextMbuf(mbuf_t *mbuf, UInt8 **mbufBuffer, size_t *mbufLength);
 public:
     // On failure, this function may leave the mbuf in an inconsistent state (length wise, still safe to free)
     // This function can only increase the length
@@ -49,6 +49,7 @@
 
 #include "FPU.h"
 #include "PCMBlitterLib.h"
+#include "REACConstants.h"
 #include <xmmintrin.h>
 #include <libkern/OSByteOrder.h>
 
@@ -1549,3 +1550,396 @@ void	SInt8ToFloat32(const UInt8 *src, Float32 *dest, unsigned int count)
 	blitter.Convert(src, dest, count);
 }
 
+
+// ===================================================================================================
+#pragma mark -
+
+// Copies one packed 24-bit sample. An unaligned 16-bit move plus a byte move is cheaper
+// than three byte moves.
+static inline void CopyInt24(const UInt8 *src, UInt8 *dst)
+{
+	*(UInt16 *)dst = *(const UInt16 *)src;
+	dst[2] = src[2];
+}
+
+// The channel count is a template parameter for the common REAC channel counts, so that
+// the per-frame loop is fully unrolled and the source stride is a constant. kNumChannels
+// is 0 for channel counts that are only known at run time.
+template <unsigned int kNumChannels>
+static inline void TDeinterleaveInt24(const UInt8 *src, UInt8 * const *dst, unsigned int numChannels, unsigned int numFrames)
+{
+	const unsigned int channels = kNumChannels ? kNumChannels : numChannels;
+	for (unsigned int frame = 0; frame < numFrames; ++frame) {
+		const unsigned int offset = 3*frame;
+		for (unsigned int channel = 0; channel < channels; ++channel)
+			CopyInt24(src + 3*channel, dst[channel] + offset);
+		src += 3*channels;
+	}
+}
+
+void DeinterleaveInt24( const UInt8 *src, UInt8 * const *dst, unsigned int numChannels, unsigned int numFrames )
+{
+	switch (numChannels) {
+		case 8:
+			TDeinterleaveInt24<8>(src, dst, numChannels, numFrames);
+			break;
+		case 16:
+			TDeinterleaveInt24<16>(src, dst, numChannels, numFrames);
+			break;
+		case 40:
+			TDeinterleaveInt24<40>(src, dst, numChannels, numFrames);
+			break;
+		default:
+			TDeinterleaveInt24<0>(src, dst, numChannels, numFrames);
+			break;
+	}
+}
+
+// ===================================================================================================
+#pragma mark -
+
+// Sample formats for the converting (de)interleave kernels below. Load4 converts four
+// consecutive samples to Float32, and Store4 converts four Float32 values to four consecutive
+// samples. Load1 and Store1 do the same for one sample, with the same results. kWidth is the
+// number of Sample elements per sample. Store4 and Store1 expect the rounding mode to be set
+// to round towards negative infinity (ROUNDMODE_NEG_INF).
+
+struct NativeInt16Format
+{
+	typedef SInt16 Sample;
+	enum { kWidth = 1 };
+
+	static inline __m128 Load4(const SInt16 *p)
+	{
+		// move the samples into the high 16 bits of 32-bit ints
+		__m128i vi = _mm_unpacklo_epi16(_mm_setzero_si128(), _mm_loadl_epi64((const __m128i *)p));
+		return _mm_mul_ps(_mm_cvtepi32_ps(vi), _mm_set1_ps(kTwoToMinus31));
+	}
+	static inline Float32 Load1(const SInt16 *p)
+	{
+		return (Float32)*p * (Float32)(1.0/32768.0);
+	}
+	static inline __m128i Convert(__m128 vf)
+	{
+		vf = _mm_add_ps(_mm_mul_ps(vf, _mm_set1_ps(32768.0f)), _mm_set1_ps(0.5f));
+		__m128i vi = _mm_cvtps_epi32(vf);
+		return _mm_packs_epi32(vi, vi);	// saturates
+	}
+	static inline void Store4(SInt16 *p, __m128 vf)
+	{
+		_mm_storel_epi64((__m128i *)p, Convert(vf));
+	}
+	static inline void Store1(SInt16 *p, Float32 f)
+	{
+		*p = (SInt16)_mm_extract_epi16(Convert(_mm_set_ss(f)), 0);
+	}
+};
+
+struct NativeInt32Format
+{
+	typedef SInt32 Sample;
+	enum { kWidth = 1 };
+
+	static inline __m128 Load4(const SInt32 *p)
+	{
+		return _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)p)), _mm_set1_ps(kTwoToMinus31));
+	}
+	static inline Float32 Load1(const SInt32 *p)
+	{
+		return (Float32)*p * kTwoToMinus31;
+	}
+	static inline __m128i Convert(__m128 vf)
+	{
+		vf = _mm_add_ps(_mm_mul_ps(vf, _mm_set1_ps(2147483648.0f)), _mm_set1_ps(0.5f));
+		vf = _mm_max_ps(vf, _mm_set1_ps(-2147483648.0f));
+		vf = _mm_min_ps(vf, _mm_set1_ps(kMaxFloat32));
+		return _mm_cvtps_epi32(vf);
+	}
+	static inline void Store4(SInt32 *p, __m128 vf)
+	{
+		_mm_storeu_si128((__m128i *)p, Convert(vf));
+	}
+	static inline void Store1(SInt32 *p, Float32 f)
+	{
+		*p = _mm_cvtsi128_si32(Convert(_mm_set_ss(f)));
+	}
+};
+
+struct NativeInt24Format
+{
+	typedef UInt8 Sample;
+	enum { kWidth = 3 };
+
+	static inline __m128 Load4(const UInt8 *p)
+	{
+		// load into the high 24 bits of 32-bit ints, without reading past the 12 bytes
+		__m128i vi = _mm_setr_epi32(*(const UInt32 *)p << 8, *(const UInt32 *)(p+3) << 8,
+									*(const UInt32 *)(p+6) << 8, *(const UInt32 *)(p+8) & 0xFFFFFF00);
+		return _mm_mul_ps(_mm_cvtepi32_ps(vi), _mm_set1_ps(kTwoToMinus31));
+	}
+	static inline Float32 Load1(const UInt8 *p)
+	{
+		SInt32 i = (SInt32)(((UInt32)p[2] << 24) | ((UInt32)p[1] << 16) | ((UInt32)p[0] << 8));
+		return (Float32)i * kTwoToMinus31;
+	}
+	static inline void Store4(UInt8 *p, __m128 vf)
+	{
+		union {
+			UInt32 i[4];
+			__m128i v;
+		} u;
+		u.v = Pack32ToLE24(NativeInt32Format::Convert(vf), _mm_setr_epi32(0x00FFFFFF, 0, 0, 0));
+		((UInt32 *)p)[0] = u.i[0];
+		((UInt32 *)p)[1] = u.i[1];
+		((UInt32 *)p)[2] = u.i[2];
+	}
+	static inline void Store1(UInt8 *p, Float32 f)
+	{
+		UInt32 i = (UInt32)_mm_cvtsi128_si32(NativeInt32Format::Convert(_mm_set_ss(f)));
+		p[0] = (UInt8)(i >> 8);
+		p[1] = (UInt8)(i >> 16);
+		p[2] = (UInt8)(i >> 24);
+	}
+};
+
+struct Float32Format
+{
+	typedef Float32 Sample;
+	enum { kWidth = 1 };
+
+	static inline __m128 Load4(const Float32 *p)			{ return _mm_loadu_ps(p); }
+	static inline Float32 Load1(const Float32 *p)			{ return *p; }
+	static inline void Store4(Float32 *p, __m128 vf)		{ _mm_storeu_ps(p, vf); }
+	static inline void Store1(Float32 *p, Float32 f)		{ *p = f; }
+};
+
+// Converts and deinterleaves in one pass. Blocks of 4 frames by 4 channels are loaded as
+// 4 vectors of 4 channels each, and transposed into 4 vectors of 4 frames each. Channels
+// and frames that do not fill a block are converted one sample at a time. As with
+// TDeinterleaveInt24, kNumChannels is 0 for channel counts that are only known at run time.
+template <class Format, unsigned int kNumChannels>
+static inline void TDeinterleaveToFloat32(const typename Format::Sample *src, Float32 * const *dst,
+										  unsigned int numChannels, unsigned int numFrames)
+{
+	typedef typename Format::Sample Sample;
+	const unsigned int channels = kNumChannels ? kNumChannels : numChannels;
+	const unsigned int stride = Format::kWidth*channels;	// Sample elements per frame
+	const unsigned int vectorChannels = channels & ~3U;
+	unsigned int frame = 0;
+
+	for (; frame+4 <= numFrames; frame += 4) {
+		const Sample *row = src + frame*stride;
+		unsigned int channel = 0;
+		for (; channel < vectorChannels; channel += 4) {
+			const Sample *p = row + Format::kWidth*channel;
+			__m128 v0 = Format::Load4(p);
+			__m128 v1 = Format::Load4(p + stride);
+			__m128 v2 = Format::Load4(p + 2*stride);
+			__m128 v3 = Format::Load4(p + 3*stride);
+			_MM_TRANSPOSE4_PS(v0, v1, v2, v3);
+			_mm_storeu_ps(dst[channel] + frame, v0);
+			_mm_storeu_ps(dst[channel+1] + frame, v1);
+			_mm_storeu_ps(dst[channel+2] + frame, v2);
+			_mm_storeu_ps(dst[channel+3] + frame, v3);
+		}
+		for (; channel < channels; ++channel) {
+			const Sample *p = row + Format::kWidth*channel;
+			for (unsigned int i = 0; i < 4; ++i)
+				dst[channel][frame+i] = Format::Load1(p + i*stride);
+		}
+	}
+	for (; frame < numFrames; ++frame) {
+		const Sample *row = src + frame*stride;
+		for (unsigned int channel = 0; channel < channels; ++channel)
+			dst[channel][frame] = Format::Load1(row + Format::kWidth*channel);
+	}
+}
+
+// The inverse of TDeinterleaveToFloat32.
+template <class Format, unsigned int kNumChannels>
+static inline void TInterleaveFromFloat32(const Float32 * const *src, typename Format::Sample *dst,
+										  unsigned int numChannels, unsigned int numFrames)
+{
+	typedef typename Format::Sample Sample;
+	const unsigned int channels = kNumChannels ? kNumChannels : numChannels;
+	const unsigned int stride = Format::kWidth*channels;	// Sample elements per frame
+	const unsigned int vectorChannels = channels & ~3U;
+	unsigned int frame = 0;
+
+	for (; frame+4 <= numFrames; frame += 4) {
+		Sample *row = dst + frame*stride;
+		unsigned int channel = 0;
+		for (; channel < vectorChannels; channel += 4) {
+			Sample *p = row + Format::kWidth*channel;
+			__m128 v0 = _mm_loadu_ps(src[channel] + frame);
+			__m128 v1 = _mm_loadu_ps(src[channel+1] + frame);
+			__m128 v2 = _mm_loadu_ps(src[channel+2] + frame);
+			__m128 v3 = _mm_loadu_ps(src[channel+3] + frame);
+			_MM_TRANSPOSE4_PS(v0, v1, v2, v3);
+			Format::Store4(p, v0);
+			Format::Store4(p + stride, v1);
+			Format::Store4(p + 2*stride, v2);
+			Format::Store4(p + 3*stride, v3);
+		}
+		for (; channel < channels; ++channel) {
+			Sample *p = row + Format::kWidth*channel;
+			for (unsigned int i = 0; i < 4; ++i)
+				Format::Store1(p + i*stride, src[channel][frame+i]);
+		}
+	}
+	for (; frame < numFrames; ++frame) {
+		Sample *row = dst + frame*stride;
+		for (unsigned int channel = 0; channel < channels; ++channel)
+			Format::Store1(row + Format::kWidth*channel, src[channel][frame]);
+	}
+}
+
+template <class Format>
+static void DeinterleaveToFloat32(const typename Format::Sample *src, Float32 * const *dst,
+								  unsigned int numChannels, unsigned int numFrames)
+{
+	switch (numChannels) {
+		case 8:
+			TDeinterleaveToFloat32<Format, 8>(src, dst, numChannels, numFrames);
+			break;
+		case 16:
+			TDeinterleaveToFloat32<Format, 16>(src, dst, numChannels, numFrames);
+			break;
+		case 40:
+			TDeinterleaveToFloat32<Format, 40>(src, dst, numChannels, numFrames);
+			break;
+		default:
+			TDeinterleaveToFloat32<Format, 0>(src, dst, numChannels, numFrames);
+			break;
+	}
+}
+
+template <class Format>
+static void InterleaveFromFloat32(const Float32 * const *src, typename Format::Sample *dst,
+								  unsigned int numChannels, unsigned int numFrames)
+{
+	ROUNDMODE_NEG_INF
+	switch (numChannels) {
+		case 8:
+			TInterleaveFromFloat32<Format, 8>(src, dst, numChannels, numFrames);
+			break;
+		case 16:
+			TInterleaveFromFloat32<Format, 16>(src, dst, numChannels, numFrames);
+			break;
+		case 40:
+			TInterleaveFromFloat32<Format, 40>(src, dst, numChannels, numFrames);
+			break;
+		default:
+			TInterleaveFromFloat32<Format, 0>(src, dst, numChannels, numFrames);
+			break;
+	}
+	RESTORE_ROUNDMODE
+}
+
+void DeinterleaveNativeInt16ToFloat32( const SInt16 *src, Float32 * const *dst, unsigned int numChannels, unsigned int numFrames )
+{
+	DeinterleaveToFloat32<NativeInt16Format>(src, dst, numChannels, numFrames);
+}
+
+void DeinterleaveNativeInt24ToFloat32( const UInt8 *src, Float32 * const *dst, unsigned int numChannels, unsigned int numFrames )
+{
+	DeinterleaveToFloat32<NativeInt24Format>(src, dst, numChannels, numFrames);
+}
+
+void DeinterleaveNativeInt32ToFloat32( const SInt32 *src, Float32 * const *dst, unsigned int numChannels, unsigned int numFrames )
+{
+	DeinterleaveToFloat32<NativeInt32Format>(src, dst, numChannels, numFrames);
+}
+
+void DeinterleaveFloat32( const Float32 *src, Float32 * const *dst, unsigned int numChannels, unsigned int numFrames )
+{
+	DeinterleaveToFloat32<Float32Format>(src, dst, numChannels, numFrames);
+}
+
+void InterleaveFloat32ToNativeInt16( const Float32 * const *src, SInt16 *dst, unsigned int numChannels, unsigned int numFrames )
+{
+	InterleaveFromFloat32<NativeInt16Format>(src, dst, numChannels, numFrames);
+}
+
+void InterleaveFloat32ToNativeInt24( const Float32 * const *src, UInt8 *dst, unsigned int numChannels, unsigned int numFrames )
+{
+	InterleaveFromFloat32<NativeInt24Format>(src, dst, numChannels, numFrames);
+}
+
+void InterleaveFloat32ToNativeInt32( const Float32 * const *src, SInt32 *dst, unsigned int numChannels, unsigned int numFrames )
+{
+	InterleaveFromFloat32<NativeInt32Format>(src, dst, numChannels, numFrames);
+}
+
+void InterleaveFloat32( const Float32 * const *src, Float32 *dst, unsigned int numChannels, unsigned int numFrames )
+{
+	InterleaveFromFloat32<Float32Format>(src, dst, numChannels, numFrames);
+}
+
+// ===================================================================================================
+#pragma mark -
+
+void Float32ToNativeInt24Metered( const Float32 *src, UInt8 *dst, unsigned int numChannels, unsigned int numFrames,
+								  UInt32 *peaks, UInt32 *clips )
+{
+	// One vector of accumulators for every 4 channels. Lane n of a vector is a channel, as
+	// every frame starts on a multiple of 4 samples.
+	__m128 vpeak[REAC_MAX_CHANNEL_COUNT/4];
+	__m128i vclips[REAC_MAX_CHANNEL_COUNT/4];
+	const __m128 vabsmask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	const __m128 vone = _mm_set1_ps(1.0f);
+	const __m128 vpeakscale = _mm_set1_ps(8388608.0f);
+	const __m128 vpeakmax = _mm_set1_ps(kMaxFloat32);
+	const unsigned int numVectors = (0 == (numChannels & 3) && numChannels <= REAC_MAX_CHANNEL_COUNT) ? numChannels/4 : 0;
+	
+	ROUNDMODE_NEG_INF
+	if (0 != numVectors) {
+		for (unsigned int v = 0; v < numVectors; ++v) {
+			vpeak[v] = _mm_div_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(peaks + 4*v))), vpeakscale);
+			vclips[v] = _mm_setzero_si128();
+		}
+		
+		for (unsigned int frame = 0; frame < numFrames; ++frame) {
+			for (unsigned int v = 0; v < numVectors; ++v) {
+				__m128 vf = _mm_loadu_ps(src);
+				__m128 vabs = _mm_and_ps(vf, vabsmask);
+				vpeak[v] = _mm_max_ps(vpeak[v], vabs);
+				// the compare gives -1 for clipped samples
+				vclips[v] = _mm_sub_epi32(vclips[v], _mm_castps_si128(_mm_cmpgt_ps(vabs, vone)));
+				NativeInt24Format::Store4(dst, vf);
+				src += 4;
+				dst += 12;
+			}
+		}
+		
+		for (unsigned int v = 0; v < numVectors; ++v) {
+			union {
+				UInt32 i[4];
+				__m128i v;
+			} u;
+			vpeak[v] = _mm_min_ps(_mm_mul_ps(vpeak[v], vpeakscale), vpeakmax);
+			_mm_storeu_si128((__m128i *)(peaks + 4*v), _mm_cvtps_epi32(vpeak[v]));
+			u.v = vclips[v];
+			for (unsigned int n = 0; n < 4; ++n)
+				clips[4*v+n] += u.i[n];
+		}
+	}
+	else {
+		for (unsigned int frame = 0; frame < numFrames; ++frame) {
+			for (unsigned int channel = 0; channel < numChannels; ++channel) {
+				Float32 f = *src++;
+				Float32 a = f < 0 ? -f : f;
+				if (a > 1.0f)
+					++clips[channel];
+				a *= 8388608.0f;
+				if (a > kMaxFloat32)
+					a = kMaxFloat32;
+				if ((UInt32)a > peaks[channel])
+					peaks[channel] = (UInt32)a;
+				NativeInt24Format::Store1(dst, f);
+				dst += 3;
+			}
+		}
+	}
+	RESTORE_ROUNDMODE
+}
@@ -97,6 +97,31 @@ void	Float32ToSInt8(const Float32 *src, SInt8 *dest, unsigned int count);
 void	UInt8ToFloat32(const UInt8 *src, Float32 *dest, unsigned int count);
 void	SInt8ToFloat32(const UInt8 *src, Float32 *dest, unsigned int count);
 
+// Splits interleaved packed 24-bit samples into one packed 24-bit buffer per channel.
+// dst is an array of numChannels buffers, each at least 3*numFrames bytes long.
+void DeinterleaveInt24( const UInt8 *src, UInt8 * const *dst, unsigned int numChannels, unsigned int numFrames );
+
+// Convert interleaved samples to one Float32 buffer per channel in one pass, and back.
+// dst (or src) is an array of numChannels buffers, each numFrames long. Any channel count
+// up to REAC_MAX_CHANNEL_COUNT works; 8, 16 and 40 channels are the fastest.
+void DeinterleaveNativeInt16ToFloat32( const SInt16 *src, Float32 * const *dst, unsigned int numChannels, unsigned int numFrames );
+void DeinterleaveNativeInt24ToFloat32( const UInt8 *src, Float32 * const *dst, unsigned int numChannels, unsigned int numFrames );
+void DeinterleaveNativeInt32ToFloat32( const SInt32 *src, Float32 * const *dst, unsigned int numChannels, unsigned int numFrames );
+void DeinterleaveFloat32( const Float32 *src, Float32 * const *dst, unsigned int numChannels, unsigned int numFrames );
+
+void InterleaveFloat32ToNativeInt16( const Float32 * const *src, SInt16 *dst, unsigned int numChannels, unsigned int numFrames );
+void InterleaveFloat32ToNativeInt24( const Float32 * const *src, UInt8 *dst, unsigned int numChannels, unsigned int numFrames );
+void InterleaveFloat32ToNativeInt32( const Float32 * const *src, SInt32 *dst, unsigned int numChannels, unsigned int numFrames );
+void InterleaveFloat32( const Float32 * const *src, Float32 *dst, unsigned int numChannels, unsigned int numFrames );
+
+// Like Float32ToNativeInt24, for interleaved frames of numChannels channels, but also meters
+// the samples in the same pass. peaks[channel] is raised to the largest absolute sample value
+// of the channel, on the scale of 24-bit samples (full scale is 0x800000, and overloads go
+// above that). clips[channel] is increased by the number of samples outside [-1, 1].
+// Channel counts that are a multiple of 4, up to REAC_MAX_CHANNEL_COUNT, are vectorized.
+void Float32ToNativeInt24Metered( const Float32 *src, UInt8 *dst, unsigned int numChannels, unsigned int numFrames,
+								  UInt32 *peaks, UInt32 *clips );
+
 // ____________________________________________________________
 // FloatToInt
 // N.B. Functions which use this should invoke SET_ROUNDMODE / RESTORE_ROUNDMODE.
@@ -45,6 +45,7 @@
  */
 
 #include "PCMBlitterLib.h"
+#include "REACConstants.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -81,4 +82,36 @@ void	PCMBlitterLibTest()
 		Float32ToNativeInt32(src, (SInt32 *)dest, nframes);
 		Float32ToSwapInt32(src, (SInt32 *)dest, nframes);
 	}
+	{
+		UInt8 *src = 0;
+		UInt8 *dest[REAC_MAX_CHANNEL_COUNT] = { 0 };
+		
+		DeinterleaveInt24(src, dest, REAC_MAX_CHANNEL_COUNT, nframes);
+	}
+	{
+		UInt8 *src = 0;
+		Float32 *dest[REAC_MAX_CHANNEL_COUNT] = { 0 };
+		
+		DeinterleaveNativeInt16ToFloat32((SInt16 *)src, dest, REAC_MAX_CHANNEL_COUNT, nframes);
+		DeinterleaveNativeInt24ToFloat32(src, dest, REAC_MAX_CHANNEL_COUNT, nframes);
+		DeinterleaveNativeInt32ToFloat32((SInt32 *)src, dest, REAC_MAX_CHANNEL_COUNT, nframes);
+		DeinterleaveFloat32((Float32 *)src, dest, REAC_MAX_CHANNEL_COUNT, nframes);
+	}
+	{
+		Float32 *src[REAC_MAX_CHANNEL_COUNT] = { 0 };
+		UInt8 *dest = 0;
+		
+		InterleaveFloat32ToNativeInt16(src, (SInt16 *)dest, REAC_MAX_CHANNEL_COUNT, nframes);
+		InterleaveFloat32ToNativeInt24(src, dest, REAC_MAX_CHANNEL_COUNT, nframes);
+		InterleaveFloat32ToNativeInt32(src, (SInt32 *)dest, REAC_MAX_CHANNEL_COUNT, nframes);
+		InterleaveFloat32(src, (Float32 *)dest, REAC_MAX_CHANNEL_COUNT, nframes);
+	}
+	{
+		Float32 *src = 0;
+		UInt8 *dest = 0;
+		UInt32 peaks[REAC_MAX_CHANNEL_COUNT] = { 0 };
+		UInt32 clips[REAC_MAX_CHANNEL_COUNT] = { 0 };
+		
+		Float32ToNativeInt24Metered(src, dest, REAC_MAX_CHANNEL_COUNT, nframes, peaks, clips);
+	}
 }
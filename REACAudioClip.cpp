@@ -85,7 +85,16 @@ IOReturn REACAudioEngine::clipOutputSamples(const void* inMixBuffer, void* destB
 				case 24:
                 {
                     UInt8* theTargetBuffer = (UInt8*)destBuf;
-                    if (nativeEndianInts)
+                    if (nativeEndianInts && streamFormat->fNumChannels <= REAC_MAX_CHANNEL_COUNT) {
+                        // Meter the output while converting it, so that overloads show up in
+                        // the statistics instead of being saturated away silently
+                        UInt32 clips[REAC_MAX_CHANNEL_COUNT] = { 0 };
+                        Float32ToNativeInt24Metered(&(theMixBuffer[theFirstSample]), &(theTargetBuffer[3*theFirstSample]),
+                                                    streamFormat->fNumChannels, numSampleFrames, outputPeaks, clips);
+                        for (UInt32 i = 0; i < streamFormat->fNumChannels; i++)
+                            outputClips[i] += clips[i];
+                    }
+                    else if (nativeEndianInts)
                         Float32ToNativeInt24(&(theMixBuffer[theFirstSample]), &(theTargetBuffer[3*theFirstSample]), theNumberSamples);
                     else
                         Float32ToSwapInt24(&(theMixBuffer[theFirstSample]), &(theTargetBuffer[3*theFirstSample]), theNumberSamples);
@@ -174,9 +183,32 @@ IOReturn REACAudioEngine::convertInputSamples(const void* sampleBuf, void* destB
         
         // Check if we're going to cross inBufferPosition (this leads to audio dropouts)
         if (inBufferPosition >= bufferBeginWritePosition && inBufferPosition < bufferStopWritePosition) {
+            inputDropouts++;
             IOLog("REACAudioEngine::convertInputSamples(): Audio drop-out! (by %d samples, when converting %d samples)\n",
                   (int) (firstSampleFrame+numSampleFrames - currentBlock*blockSize), (int) numSampleFrames);
         }
+        
+        // Keep track of how close the reads have come to the network write position. This is
+        // the worst-case occupancy of the ring, and tells how much of bufferOffsetFactor is
+        // actually needed to absorb network and scheduling latency spikes.
+        const UInt32 ringFrames = blockSize*numBlocks;
+        const UInt32 readEndFrame = firstSampleFrame+numSampleFrames;
+        const UInt32 writeFrame = currentBlock*blockSize;
+        // The distance is taken to be within half a ring either way, so that reads that have
+        // passed the write position show up as no headroom rather than almost a full ring.
+        SInt32 headroom = (SInt32)writeFrame - (SInt32)readEndFrame;
+        if (headroom > (SInt32)ringFrames/2) {
+            headroom -= ringFrames;
+        }
+        else if (headroom <= -(SInt32)ringFrames/2) {
+            headroom += ringFrames;
+        }
+        if (headroom < 0) {
+            headroom = 0;
+        }
+        if ((UInt32)headroom < inputHeadroomLowWater) {
+            inputHeadroomLowWater = headroom;
+        }
     }
     
 	//	figure out what sort of blit we need to do
@@ -31,6 +31,9 @@
 #include <IOKit/audio/IOAudioDefines.h>
 #include <IOKit/IOLib.h>
 #include <IOKit/IOWorkLoop.h>
+#include <IOKit/IOTimerEventSource.h>
+#include <IOKit/IOUserClient.h>
+#include <libkern/c++/OSArray.h>
 
 #include "REACConnection.h"
 
@@ -54,6 +57,11 @@
 // Note that this is only the default value, and is overridden if found in Info.plist
 #define NUM_BLOCKS_DEFAULT             1024
 
+// The limits for changing the buffer geometry with setProperties. NUM_BLOCKS_MAX is about a
+// second of audio, and rings of that size take up to 12 MB of kernel memory each.
+#define NUM_BLOCKS_MAX                 8192
+#define BUFFER_OFFSET_FACTOR_MAX       (NUM_BLOCKS_MAX/2)
+
 #define super IOAudioEngine
 
 OSDefineMetaClassAndStructors(REACAudioEngine, super)
@@ -94,6 +102,16 @@ bool REACAudioEngine::init(REACConnection* proto, OSDictionary *properties) {
     inputStream = outputStream = NULL;
     duringHardwareInit = FALSE;
     mLastValidSampleFrame = 0;
+    timestampsRunning = false;
+    inputHeadroomLowWater = 0;
+    memset(&timeline, 0, sizeof(timeline));
+    timelineSequence = 0;
+    measuredSampleRateMilliHz = 0;
+    inputDropouts = 0;
+    memset(outputPeaks, 0, sizeof(outputPeaks));
+    memset(outputClips, 0, sizeof(outputClips));
+    statisticsTimer = NULL;
+    changingGeometry = 0;
     result = true;
     
 Done:
@@ -134,8 +152,17 @@ bool REACAudioEngine::initHardware(IOService *provider) {
     }
     
     setSampleRate(&initialSampleRate);
-    setSampleOffset(blockSize*bufferOffsetFactor);
+    // Stay far enough behind the network that late packets within the reorder window
+    // are in place before they are read.
+    setSampleOffset(blockSize*(bufferOffsetFactor+protocol->getReorderWindow()));
     setClockIsStable(FALSE);
+    // The safety offset above is reported separately, and covers the geometry and the
+    // reorder window. On top of that, a sample waits for the rest of its packet before the
+    // packet is sent, which is one packet in each direction. In REAC_MASTER mode the timer
+    // wakes up early by the time it takes to send a packet, so packets leave when they are
+    // due and that time is not added here. This doesn't change while the engine exists.
+    setInputSampleLatency(REAC_SAMPLES_PER_PACKET);
+    setOutputSampleLatency(REAC_SAMPLES_PER_PACKET);
     
     // Set the number of sample frames in each buffer
     setNumSampleFramesPerBuffer(blockSize * numBlocks);
@@ -144,6 +171,13 @@ bool REACAudioEngine::initHardware(IOService *provider) {
     if (!wl) {
         goto Done;
     }
+    
+    statisticsTimer = IOTimerEventSource::timerEventSource(this, &REACAudioEngine::statisticsTimerFired);
+    if (NULL == statisticsTimer || kIOReturnSuccess != wl->addEventSource(statisticsTimer)) {
+        IOLog("REACAudioEngine[%p]::initHardware() - Error: Failed to create statistics timer.\n", this);
+        goto Done;
+    }
+    statisticsTimer->setTimeoutMS(1000);
             
     result = true;
     
@@ -211,7 +245,7 @@ bool REACAudioEngine::createAudioStreams(IOAudioSampleRate *sampleRate) {
     mOutBufferSize = bufferSizePerChannel * numOutChannels;
     
     if (mInBuffer == NULL) {
-        mInBuffer = (void *)IOMalloc(mInBufferSize);
+        mInBuffer = allocateRing(mInBufferSize);
         if (NULL == mInBuffer) {
             IOLog("REAC: Error allocating input buffer - %d bytes.\n", (int) mInBufferSize);
             goto Error;
@@ -219,13 +253,16 @@ bool REACAudioEngine::createAudioStreams(IOAudioSampleRate *sampleRate) {
     }
     
     if (mOutBuffer == NULL) {
-        mOutBuffer = (void *)IOMalloc(mOutBufferSize);
+        mOutBuffer = allocateRing(mOutBufferSize);
         if (NULL == mOutBuffer) {
             IOLog("REAC: Error allocating output buffer - %lu bytes.\n", (unsigned long)mOutBufferSize);
             goto Error;
         }
     }
     
+    IOLog("REACAudioEngine[%p]::createAudioStreams(): Input ring %d bytes, output ring %d bytes.\n",
+          this, (int) mInBufferSize, (int) mOutBufferSize);
+    
     inputStream->setSampleBuffer(mInBuffer, mInBufferSize);
     addAudioStream(inputStream);
     inputStream->release();
@@ -252,19 +289,43 @@ Done:
 }
 
  
+void *REACAudioEngine::allocateRing(UInt32 size) {
+    // Kernel memory is wired, so the ring never faults once it is allocated. Page alignment
+    // keeps the ring off pages shared with other allocations, and zeroing it here touches
+    // every page before the first packet does.
+    void *ring = IOMallocAligned(size, PAGE_SIZE);
+    if (NULL != ring) {
+        memset(ring, 0, size);
+    }
+    return ring;
+}
+
+void REACAudioEngine::freeRing(void *ring, UInt32 size) {
+    IOFreeAligned(ring, size);
+}
+
 void REACAudioEngine::free() {
     //IOLog("REACAudioEngine[%p]::free()\n", this);
     
+    if (NULL != statisticsTimer) {
+        statisticsTimer->cancelTimeout();
+        if (NULL != getWorkLoop()) {
+            getWorkLoop()->removeEventSource(statisticsTimer);
+        }
+        statisticsTimer->release();
+        statisticsTimer = NULL;
+    }
+    
     if (NULL != protocol) {
         protocol->release();
     }
     
     if (NULL != mInBuffer) {
-        IOFree(mInBuffer, mInBufferSize);
+        freeRing(mInBuffer, mInBufferSize);
         mInBuffer = NULL;
     }
     if (NULL != mOutBuffer) {
-        IOFree(mOutBuffer, mOutBufferSize);
+        freeRing(mOutBuffer, mOutBufferSize);
         mOutBuffer = NULL;
     }
         
@@ -286,8 +347,13 @@ IOReturn REACAudioEngine::performAudioEngineStart() {
     // How that is implemented depends on the type of hardware - PCI hardware will likely
     // receive an interrupt to perform that task
     
-    takeTimeStamp(false);
-    currentBlock = 0;
+    // The ring position and the timestamps are owned by the connection's work loop, so the
+    // engine is restarted there (see REACConnection::runAction).
+    protocol->runAction(&REACAudioEngine::runningAction, this, (void *)true);
+    inputHeadroomLowWater = blockSize*numBlocks;
+    
+    // Wake up the connection if it is idle
+    protocol->setInUse(true);
     
     return kIOReturnSuccess;
 }
@@ -295,6 +361,12 @@ IOReturn REACAudioEngine::performAudioEngineStart() {
 IOReturn REACAudioEngine::performAudioEngineStop() {
     //IOLog("REACAudioEngine[%p]::performAudioEngineStop()\n", this);
     
+    IOLog("REACAudioEngine[%p]::performAudioEngineStop(): Worst-case input headroom was %d samples (%d us).\n",
+          this, (int) inputHeadroomLowWater, (int) ((UInt64)inputHeadroomLowWater*1000000/REAC_SAMPLE_RATE));
+    
+    protocol->runAction(&REACAudioEngine::runningAction, this, (void *)false);
+    protocol->setInUse(false);
+    
     return kIOReturnSuccess;
 }
 
@@ -312,6 +384,206 @@ UInt32 REACAudioEngine::getCurrentSampleFrame() {
 }
 
 
+IOReturn REACAudioEngine::setProperties(OSObject *properties) {
+    OSDictionary *dict = OSDynamicCast(OSDictionary, properties);
+    if (NULL == dict) {
+        return kIOReturnBadArgument;
+    }
+    
+    OSDictionary *channelGain = OSDynamicCast(OSDictionary, dict->getObject(CHANNEL_GAIN_KEY));
+    OSNumber *offsetFactorNumber = OSDynamicCast(OSNumber, dict->getObject(BUFFER_OFFSET_FACTOR_KEY));
+    OSNumber *numBlocksNumber = OSDynamicCast(OSNumber, dict->getObject(NUM_BLOCKS_KEY));
+    OSDictionary *otherProperties = NULL;
+    IOReturn result = kIOReturnSuccess;
+    
+    if (NULL == channelGain && NULL == offsetFactorNumber && NULL == numBlocksNumber) {
+        return super::setProperties(properties);
+    }
+    
+    // Any process can set properties, but these resize kernel buffers and change what is
+    // sent on the network.
+    result = IOUserClient::clientHasPrivilege(current_task(), kIOClientPrivilegeAdministrator);
+    if (kIOReturnSuccess != result) {
+        IOLog("REACAudioEngine[%p]::setProperties(): Only administrators may change the engine.\n", this);
+        return result;
+    }
+    
+    if (NULL != channelGain) {
+        result = setChannelGain(channelGain);
+        if (kIOReturnSuccess != result) {
+            return result;
+        }
+    }
+    
+    if (NULL != offsetFactorNumber || NULL != numBlocksNumber) {
+        UInt32 newBufferOffsetFactor = offsetFactorNumber ? offsetFactorNumber->unsigned32BitValue() : bufferOffsetFactor;
+        UInt32 newNumBlocks = numBlocksNumber ? numBlocksNumber->unsigned32BitValue() : numBlocks;
+        
+        result = setGeometry(newBufferOffsetFactor, newNumBlocks);
+        if (kIOReturnSuccess != result) {
+            return result;
+        }
+    }
+    
+    // Leave the rest to the superclass
+    otherProperties = OSDictionary::withDictionary(dict);
+    if (NULL == otherProperties) {
+        return kIOReturnNoMemory;
+    }
+    otherProperties->removeObject(CHANNEL_GAIN_KEY);
+    otherProperties->removeObject(BUFFER_OFFSET_FACTOR_KEY);
+    otherProperties->removeObject(NUM_BLOCKS_KEY);
+    if (0 != otherProperties->getCount()) {
+        result = super::setProperties(otherProperties);
+    }
+    otherProperties->release();
+    
+    return result;
+}
+
+IOReturn REACAudioEngine::setChannelGain(OSDictionary *channelGain) {
+    OSNumber *channel = OSDynamicCast(OSNumber, channelGain->getObject(CHANNEL_GAIN_CHANNEL_KEY));
+    OSNumber *gain = OSDynamicCast(OSNumber, channelGain->getObject(CHANNEL_GAIN_GAIN_KEY));
+    if (NULL == channel || NULL == gain || gain->unsigned32BitValue() > 0xff) {
+        return kIOReturnBadArgument;
+    }
+    return protocol->setChannelGain(channel->unsigned32BitValue(), gain->unsigned8BitValue());
+}
+
+IOReturn REACAudioEngine::runningAction(OSObject *owner, void *engine, void *running, void*, void*) {
+    REACAudioEngine *e = (REACAudioEngine *)engine;
+    
+    if (running) {
+        e->currentBlock = 0;
+        // Don't estimate the sample rate across the time the engine was stopped
+        e->timelineSequence++;
+        __sync_synchronize();
+        e->timeline.uptimeNS = 0;
+        __sync_synchronize();
+        e->timelineSequence++;
+        e->takeTimeStamp(false);
+    }
+    e->timestampsRunning = (NULL != running);
+    return kIOReturnSuccess;
+}
+
+IOReturn REACAudioEngine::geometryAction(OSObject *owner, void *engine, void *geometry, void*, void*) {
+    REACAudioEngine *e = (REACAudioEngine *)engine;
+    Geometry *g = (Geometry *)geometry;
+    
+    // CoreAudio is told to stop doing IO and to pick up the new buffer size when the
+    // engine is resumed. The engine's gate is held throughout, so that a client can't
+    // start the engine while the rings are changed.
+    const bool wasRunning = (kIOAudioEngineRunning == e->getState());
+    if (wasRunning) {
+        e->pauseAudioEngine();
+    }
+    
+    if (NULL != g->inBuffer) {
+        e->protocol->runAction(&REACAudioEngine::swapBuffersAction, e, g);
+        e->inputStream->setSampleBuffer(e->mInBuffer, e->mInBufferSize);
+        e->outputStream->setSampleBuffer(e->mOutBuffer, e->mOutBufferSize);
+        e->inputHeadroomLowWater = e->blockSize*e->numBlocks;
+    }
+    
+    e->setNumSampleFramesPerBuffer(e->blockSize * e->numBlocks);
+    e->setProperty(NUM_BLOCKS_KEY, e->numBlocks, 32);
+    e->bufferOffsetFactor = g->bufferOffsetFactor;
+    e->setSampleOffset(e->blockSize*(e->bufferOffsetFactor+e->protocol->getReorderWindow()));
+    e->setProperty(BUFFER_OFFSET_FACTOR_KEY, e->bufferOffsetFactor, 32);
+    
+    if (wasRunning) {
+        e->resumeAudioEngine();
+    }
+    return kIOReturnSuccess;
+}
+
+IOReturn REACAudioEngine::swapBuffersAction(OSObject *owner, void *engine, void *geometry, void*, void*) {
+    REACAudioEngine *e = (REACAudioEngine *)engine;
+    Geometry *g = (Geometry *)geometry;
+    
+    // This runs on the connection's work loop, so no packet is being written to the
+    // rings. The engine starts over from the first block, so there is no old data to
+    // keep. The old buffers are handed back in g.
+    { void *p = e->mInBuffer; e->mInBuffer = g->inBuffer; g->inBuffer = p; }
+    { UInt32 n = e->mInBufferSize; e->mInBufferSize = g->inBufferSize; g->inBufferSize = n; }
+    { void *p = e->mOutBuffer; e->mOutBuffer = g->outBuffer; g->outBuffer = p; }
+    { UInt32 n = e->mOutBufferSize; e->mOutBufferSize = g->outBufferSize; g->outBufferSize = n; }
+    e->numBlocks = g->numBlocks;
+    e->currentBlock = 0;
+    if (e->timestampsRunning) {
+        e->takeTimeStamp(false);
+    }
+    return kIOReturnSuccess;
+}
+
+IOReturn REACAudioEngine::setGeometry(UInt32 newBufferOffsetFactor, UInt32 newNumBlocks) {
+    IOCommandGate *gate = getCommandGate();
+    Geometry g;
+    
+    if (0 == newNumBlocks || newNumBlocks > NUM_BLOCKS_MAX || newBufferOffsetFactor > BUFFER_OFFSET_FACTOR_MAX) {
+        IOLog("REACAudioEngine[%p]::setGeometry(): NumBlocks %d or BufferOffsetFactor %d is out of range.\n",
+              this, (int) newNumBlocks, (int) newBufferOffsetFactor);
+        return kIOReturnBadArgument;
+    }
+    
+    // The ring has to have room for the offset and what CoreAudio reads at a time
+    if (2*(newBufferOffsetFactor+protocol->getReorderWindow()) > newNumBlocks) {
+        IOLog("REACAudioEngine[%p]::setGeometry(): NumBlocks %d is too small for BufferOffsetFactor %d.\n",
+              this, (int) newNumBlocks, (int) newBufferOffsetFactor);
+        return kIOReturnBadArgument;
+    }
+    
+    // BlockSize comes from Info.plist, so the ring sizes are checked rather than trusted to fit
+    const UInt64 bytesPerBlockPerChannel = (UInt64)blockSize * REAC_RESOLUTION;
+    const UInt64 inBufferSize = bytesPerBlockPerChannel * newNumBlocks * protocol->getDeviceInfo()->in_channels;
+    const UInt64 outBufferSize = bytesPerBlockPerChannel * newNumBlocks * protocol->getDeviceInfo()->out_channels;
+    if (inBufferSize > 0xffffffffULL || outBufferSize > 0xffffffffULL) {
+        IOLog("REACAudioEngine[%p]::setGeometry(): NumBlocks %d makes too large buffers.\n",
+              this, (int) newNumBlocks);
+        return kIOReturnBadArgument;
+    }
+    
+    if (NULL == gate) {
+        return kIOReturnError;
+    }
+    
+    if (!OSCompareAndSwap(0, 1, &changingGeometry)) {
+        return kIOReturnBusy;
+    }
+    
+    memset(&g, 0, sizeof(g));
+    g.bufferOffsetFactor = newBufferOffsetFactor;
+    g.numBlocks = newNumBlocks;
+    
+    // The new rings are allocated before the engine is paused, so that it isn't held up
+    // by the allocation. numBlocks only changes while changingGeometry is set.
+    if (newNumBlocks != numBlocks) {
+        g.inBufferSize = (UInt32)inBufferSize;
+        g.outBufferSize = (UInt32)outBufferSize;
+        g.inBuffer = allocateRing(g.inBufferSize);
+        g.outBuffer = allocateRing(g.outBufferSize);
+        
+        if (NULL == g.inBuffer || NULL == g.outBuffer) {
+            IOLog("REACAudioEngine[%p]::setGeometry(): Failed to allocate buffers.\n", this);
+            if (NULL != g.inBuffer) freeRing(g.inBuffer, g.inBufferSize);
+            if (NULL != g.outBuffer) freeRing(g.outBuffer, g.outBufferSize);
+            changingGeometry = 0;
+            return kIOReturnNoMemory;
+        }
+    }
+    
+    gate->runAction(&REACAudioEngine::geometryAction, this, &g);
+    // The streams no longer use the old rings
+    if (NULL != g.inBuffer) freeRing(g.inBuffer, g.inBufferSize);
+    if (NULL != g.outBuffer) freeRing(g.outBuffer, g.outBufferSize);
+    changingGeometry = 0;
+    
+    IOLog("REACAudioEngine[%p]::setGeometry(): NumBlocks %d, BufferOffsetFactor %d.\n",
+          this, (int) numBlocks, (int) bufferOffsetFactor);
+    return kIOReturnSuccess;
+}
+
 IOReturn REACAudioEngine::performFormatChange(IOAudioStream *audioStream, const IOAudioStreamFormat *newFormat,
                                               const IOAudioSampleRate *newSampleRate) {
     if (!duringHardwareInit) {
@@ -329,7 +601,7 @@ IOReturn REACAudioEngine::performFormatChange(IOAudioStream *audioStream, const
     return kIOReturnSuccess;
 }
 
-void REACAudioEngine::gotSamples(UInt8 **data, UInt32 *bufferSize) {
+void REACAudioEngine::gotSamples(SInt32 packetOffset, UInt8 **data, UInt32 *bufferSize) {
     if (NULL == mInBuffer) {
         // This should never happen. But better complain than crash the computer I guess
         IOLog("REACAudioEngine::gotSamples(): Internal error.\n");
@@ -345,12 +617,42 @@ void REACAudioEngine::gotSamples(UInt8 **data, UInt32 *bufferSize) {
     const int bytesPerSample = inputStream->format.fBitWidth/8 * inputStream->format.fNumChannels;
     const int bytesPerPacket = bytesPerSample * REAC_SAMPLES_PER_PACKET;
     
-    *data = (UInt8 *)mInBuffer + currentBlock*blockSize*bytesPerSample;
-    *bufferSize = bytesPerPacket;
+    if (REACConnection::REAC_MASTER == protocol->getMode()) {
+        // The output side drives the block counter; the input is written wherever it is.
+        if (packetOffset < 0) {
+            *data = NULL;
+            return;
+        }
+        *data = (UInt8 *)mInBuffer + currentBlock*blockSize*bytesPerSample;
+        *bufferSize = bytesPerPacket;
+        return;
+    }
+    
+    if (packetOffset < 0) {
+        // A late packet. Put it in the block it would have been written to.
+        if ((UInt32) -packetOffset >= numBlocks) {
+            *data = NULL;
+            return;
+        }
+        const UInt32 block = (currentBlock+numBlocks-(UInt32)-packetOffset) % numBlocks;
+        *data = (UInt8 *)mInBuffer + block*blockSize*bytesPerSample;
+        *bufferSize = bytesPerPacket;
+        return;
+    }
     
-    if (REACConnection::REAC_MASTER != protocol->getMode()) {
-        incrementBlockCounter();
+    const UInt64 expectedCounter = protocol->getLastCounter()+1;
+    if ((UInt32) packetOffset < numBlocks) {
+        // Leave silence in the blocks of the missing packets, in case they don't show up.
+        for (SInt32 i=0; i<packetOffset; i++) {
+            memset((UInt8 *)mInBuffer + currentBlock*blockSize*bytesPerSample, 0, bytesPerPacket);
+            incrementBlockCounter(expectedCounter+i);
+        }
     }
+    // else: The gap is bigger than the whole ring; just continue from where we are.
+    
+    *data = (UInt8 *)mInBuffer + currentBlock*blockSize*bytesPerSample;
+    *bufferSize = bytesPerPacket;
+    incrementBlockCounter(expectedCounter+packetOffset);
 }
 
 void REACAudioEngine::getSamples(UInt8 **data, UInt32 *bufferSize) {
@@ -361,17 +663,172 @@ void REACAudioEngine::getSamples(UInt8 **data, UInt32 *bufferSize) {
     *bufferSize = bytesPerPacket;
     
     if (REACConnection::REAC_MASTER == protocol->getMode()) {
-        incrementBlockCounter();
+        // These samples go into the next packet that is sent
+        incrementBlockCounter(protocol->getLastSentCounter()+1);
     }
     return;
 }
 
-void REACAudioEngine::incrementBlockCounter() {
+void REACAudioEngine::incrementBlockCounter(UInt64 blockCounter) {
     currentBlock++;
     if (currentBlock >= numBlocks) {
         currentBlock = 0;
-        takeTimeStamp();
+        if (timestampsRunning) {
+            takeTimeStamp();
+        }
+        recordTimeline(blockCounter);
+    }
+}
+
+void REACAudioEngine::recordTimeline(UInt64 counter) {
+    UInt64 uptimeNS;
+    uint64_t time;
+    clock_sec_t secs;
+    clock_nsec_t nanosecs;
+    UInt64 sampleRateMilliHz = 0;
+    
+    clock_get_calendar_nanotime(&secs, &nanosecs);
+    clock_get_uptime(&time);
+    absolutetime_to_nanoseconds(time, &uptimeNS);
+    
+    if (0 != timeline.uptimeNS && uptimeNS > timeline.uptimeNS && counter > timeline.counter) {
+        sampleRateMilliHz = (counter-timeline.counter)*REAC_SAMPLES_PER_PACKET*1000000000000ULL/(uptimeNS-timeline.uptimeNS);
+    }
+    if (0 != sampleRateMilliHz) {
+        measuredSampleRateMilliHz = sampleRateMilliHz;
+    }
+    
+    // This is on the packet path, so the record is only stored here. It is turned into a
+    // dictionary by publishTimeline on the engine's work loop.
+    timelineSequence++;
+    __sync_synchronize();
+    timeline.counter = counter;
+    timeline.loopCount = status->fCurrentLoopCount;
+    timeline.uptimeNS = uptimeNS;
+    timeline.calendarNS = (UInt64)secs*1000000000 + nanosecs;
+    timeline.sampleRateMilliHz = sampleRateMilliHz;
+    __sync_synchronize();
+    timelineSequence++;
+}
+
+void REACAudioEngine::publishTimeline() {
+    TimelineRecord record;
+    UInt32 sequence;
+    OSDictionary *dict = NULL;
+    
+    do {
+        while ((sequence = timelineSequence) & 1) {
+            // Being written
+        }
+        __sync_synchronize();
+        memcpy(&record, &timeline, sizeof(record));
+        __sync_synchronize();
+    } while (sequence != timelineSequence);
+    
+    if (0 == record.uptimeNS) {
+        // The ring has not wrapped around since the engine was started
+        return;
+    }
+    
+    dict = OSDictionary::withCapacity(5);
+    if (NULL == dict) {
+        return;
+    }
+    
+    setDictionaryNumber(dict, TIMELINE_COUNTER_KEY, record.counter);
+    setDictionaryNumber(dict, TIMELINE_LOOP_COUNT_KEY, record.loopCount);
+    setDictionaryNumber(dict, TIMELINE_UPTIME_KEY, record.uptimeNS);
+    setDictionaryNumber(dict, TIMELINE_CALENDAR_KEY, record.calendarNS);
+    setDictionaryNumber(dict, TIMELINE_SAMPLE_RATE_KEY, record.sampleRateMilliHz);
+    
+    setProperty(TIMELINE_KEY, dict);
+    dict->release();
+}
+
+void REACAudioEngine::statisticsTimerFired(OSObject *target, IOTimerEventSource *sender) {
+    REACAudioEngine *engine = OSDynamicCast(REACAudioEngine, target);
+    if (NULL == engine) {
+        // This should never happen
+        IOLog("REACAudioEngine::statisticsTimerFired(): Internal error!\n");
+        return;
+    }
+    
+    engine->publishTimeline();
+    engine->publishStatistics();
+    sender->setTimeoutMS(1000);
+}
+
+void REACAudioEngine::publishStatistics() {
+    // The connection's counters are updated on the connection's own work loop. They are
+    // read here without taking its gate, so that the network side is not slowed down by
+    // this. A snapshot may mix counters from two packets, which is fine for statistics.
+    const REACConnection::Statistics &stats = protocol->getStatistics();
+    OSDictionary *dict = OSDictionary::withCapacity(20);
+    if (NULL == dict) {
+        return;
+    }
+    
+    setDictionaryNumber(dict, "Packets", stats.packets);
+    setDictionaryNumber(dict, "LostPackets", stats.lostPackets);
+    setDictionaryNumber(dict, "ReorderedPackets", stats.reorderedPackets);
+    setDictionaryNumber(dict, "LatePackets", stats.latePackets);
+    setDictionaryNumber(dict, "DuplicatePackets", stats.duplicatePackets);
+    setDictionaryHistogram(dict, "LossBursts", stats.lossBursts);
+    setDictionaryNumber(dict, "LongestLossBurst", stats.longestLossBurst);
+    setDictionaryNumber(dict, "ChecksumErrors", protocol->getChecksumErrors());
+    setDictionaryHistogram(dict, "InterArrival", stats.interArrival);
+    setDictionaryHistogram(dict, "TimerLateness", stats.timerLateness);
+    setDictionaryHistogram(dict, "TxJitter", stats.txJitter);
+    setDictionaryNumber(dict, "SpinTimeNS", stats.spinTimeNS);
+    setDictionaryNumber(dict, "Idle", protocol->isIdle() ? 1 : 0);
+    setDictionaryNumber(dict, "InputHeadroomLowWater", inputHeadroomLowWater);
+    setDictionaryNumber(dict, "InputDropouts", inputDropouts);
+    setDictionaryNumber(dict, "MeasuredSampleRateMilliHz", measuredSampleRateMilliHz);
+    
+    // The IO thread may raise a peak while it is reset here, which only loses that peak
+    // from the meter.
+    UInt32 outChannels = protocol->getDeviceInfo()->out_channels;
+    UInt64 peaks[REAC_MAX_CHANNEL_COUNT];
+    if (outChannels > REAC_MAX_CHANNEL_COUNT) {
+        outChannels = REAC_MAX_CHANNEL_COUNT;
+    }
+    for (UInt32 i=0; i<outChannels; i++) {
+        peaks[i] = outputPeaks[i];
+        outputPeaks[i] = 0;
+    }
+    setDictionaryArray(dict, "OutputPeaks", peaks, outChannels);
+    setDictionaryArray(dict, "OutputClips", outputClips, outChannels);
+    
+    setProperty(STATISTICS_KEY, dict);
+    dict->release();
+}
+
+void REACAudioEngine::setDictionaryNumber(OSDictionary *dict, const char *key, UInt64 value) {
+    OSNumber *number = OSNumber::withNumber((unsigned long long) value, 64);
+    if (NULL != number) {
+        dict->setObject(key, number);
+        number->release();
+    }
+}
+
+void REACAudioEngine::setDictionaryHistogram(OSDictionary *dict, const char *key, const UInt64 *histogram) {
+    setDictionaryArray(dict, key, histogram, REAC_HISTOGRAM_BUCKETS);
+}
+
+void REACAudioEngine::setDictionaryArray(OSDictionary *dict, const char *key, const UInt64 *values, UInt32 count) {
+    OSArray *array = OSArray::withCapacity(count);
+    if (NULL == array) {
+        return;
+    }
+    for (UInt32 i=0; i<count; i++) {
+        OSNumber *number = OSNumber::withNumber((unsigned long long) values[i], 64);
+        if (NULL != number) {
+            array->setObject(number);
+            number->release();
+        }
     }
+    dict->setObject(key, array);
+    array->release();
 }
 
 
@@ -32,6 +32,28 @@
 
 #define REACAudioEngine                com_pereckerdal_driver_REACAudioEngine
 
+// A dictionary about the last time the ring buffer wrapped around, published once a second.
+// It maps the REAC packet counter to host time, so that captures from several computers can
+// be aligned.
+#define TIMELINE_KEY                   "Timeline"
+#define TIMELINE_COUNTER_KEY           "Counter"      // Extended counter of the last packet in the ring
+#define TIMELINE_LOOP_COUNT_KEY        "LoopCount"    // The engine loop count that starts after that packet
+#define TIMELINE_UPTIME_KEY            "UptimeNS"
+#define TIMELINE_CALENDAR_KEY          "CalendarNS"   // Nanoseconds since 1970
+#define TIMELINE_SAMPLE_RATE_KEY       "SampleRateMilliHz" // Measured over the last loop; 0 if unknown
+
+// A dictionary with counters about the health of the connection, updated once a second.
+// Histograms are arrays of counts; see REACConnection::Statistics for their buckets.
+#define STATISTICS_KEY                 "Statistics"
+
+// Set with setProperties to change the gain of a channel on the REAC network, in REAC_MASTER
+// mode. A dictionary with the channel number and the gain byte that is sent for it.
+#define CHANNEL_GAIN_KEY               "ChannelGain"
+#define CHANNEL_GAIN_CHANNEL_KEY       "Channel"
+#define CHANNEL_GAIN_GAIN_KEY          "Gain"
+
+#define REAC_CACHE_LINE_SIZE 64
+
 class REACAudioEngine : public IOAudioEngine
 {
     OSDeclareDefaultStructors(REACAudioEngine)
@@ -57,13 +79,52 @@ class REACAudioEngine : public IOAudioEngine
     UInt32              blockSize;                // In sample frames -- fixed, as defined in the Info.plist (e.g. 8192)
     UInt32              numBlocks;
     UInt32              bufferOffsetFactor;
-    UInt32              currentBlock;
 
     bool                duringHardwareInit;
     
     // For clipping routines
     UInt64              lastSampleTimeNS;
     
+    // The engine is used from two threads at once: the connection's work loop writes the
+    // ring for every packet, while the IO thread converts samples. The fields that each of
+    // them writes are kept on cache lines of their own, so that they do not make the other
+    // thread's cache lines bounce between cores.
+    UInt8               sharedFieldsPadding[REAC_CACHE_LINE_SIZE];
+    
+    // Written by the connection's work loop. The engine's work loop changes them with
+    // runningAction and swapBuffersAction, which run on the connection's work loop.
+    UInt32              currentBlock;
+    bool                timestampsRunning; // Whether ring wraps are timestamped, which is while the engine runs
+    // The record of the last ring wrap, published by the statistics timer. timelineSequence
+    // is odd while the record is being written. The previous record is also what the sample
+    // rate is estimated from.
+    struct TimelineRecord {
+        UInt64 counter;
+        UInt64 loopCount;
+        UInt64 uptimeNS;
+        UInt64 calendarNS;
+        UInt64 sampleRateMilliHz;
+    };
+    TimelineRecord      timeline;
+    volatile UInt32     timelineSequence;
+    UInt64              measuredSampleRateMilliHz;
+    UInt8               networkFieldsPadding[REAC_CACHE_LINE_SIZE];
+    
+    // Written by the IO thread
+    // The smallest distance (in sample frames) seen between the end of a CoreAudio input
+    // read and the position the network is writing to, since the engine was started.
+    UInt32              inputHeadroomLowWater;
+    UInt64              inputDropouts; // The number of times CoreAudio read input where the network was writing
+    // Output meters, updated by clipOutputSamples. The peaks are the largest absolute sample
+    // values since the statistics were last published, and are reset then. They are on the
+    // scale of 24 bit samples, with full scale at 0x800000.
+    UInt32              outputPeaks[REAC_MAX_CHANNEL_COUNT];
+    UInt64              outputClips[REAC_MAX_CHANNEL_COUNT]; // Samples outside [-1, 1], which were saturated
+    UInt8               ioThreadFieldsPadding[REAC_CACHE_LINE_SIZE];
+    
+    IOTimerEventSource *statisticsTimer;
+    volatile UInt32     changingGeometry;
+    
     
 public:
     
@@ -83,6 +144,11 @@ public:
     
     virtual UInt32 getCurrentSampleFrame();
     
+    // Accepts BufferOffsetFactor and NumBlocks, to change the buffer geometry while
+    // the engine is loaded, and ChannelGain. These can only be set by administrators.
+    // Other properties are passed on to the superclass.
+    virtual IOReturn setProperties(OSObject *properties);
+    
     virtual IOReturn performFormatChange(IOAudioStream *audioStream, const IOAudioStreamFormat *newFormat,
                                          const IOAudioSampleRate *newSampleRate);
 
@@ -93,11 +159,48 @@ public:
                                          UInt32 numSampleFrames, const IOAudioStreamFormat *streamFormat,
                                          IOAudioStream *audioStream);
     
-    void gotSamples(UInt8 **data, UInt32 *bufferSize);
+    // packetOffset is as in reac_samples_callback_t. *data is set to NULL if the packet
+    // should be dropped.
+    void gotSamples(SInt32 packetOffset, UInt8 **data, UInt32 *bufferSize);
     void getSamples(UInt8 **data, UInt32 *bufferSize);
     
 protected:
-    void incrementBlockCounter();
+    // blockCounter is the extended counter of the packet in the block that is finished.
+    void incrementBlockCounter(UInt64 blockCounter);
+    // Called on the connection's work loop when the ring wraps around.
+    void recordTimeline(UInt64 counter);
+    void publishTimeline();
+    
+    IOReturn setChannelGain(OSDictionary *channelGain);
+    
+    // Allocates a page aligned, zeroed ring buffer.
+    static void *allocateRing(UInt32 size);
+    static void freeRing(void *ring, UInt32 size);
+    
+    // The new geometry, and the new rings if the number of blocks changes. The old rings
+    // are handed back in the same fields, to be freed.
+    struct Geometry {
+        UInt32 bufferOffsetFactor;
+        UInt32 numBlocks;
+        void  *inBuffer;
+        UInt32 inBufferSize;
+        void  *outBuffer;
+        UInt32 outBufferSize;
+    };
+    // Runs on the connection's command gate. Starting restarts the ring at the first block
+    // and takes the first timestamp, so that they can't interleave with a ring wrap.
+    static IOReturn runningAction(OSObject *owner, void *engine, void *running, void*, void*);
+    // Runs on the engine's command gate. Pauses the engine, has swapBuffersAction run on
+    // the connection's command gate and resumes the engine with the new geometry.
+    static IOReturn geometryAction(OSObject *owner, void *engine, void *geometry, void*, void*);
+    static IOReturn swapBuffersAction(OSObject *owner, void *engine, void *geometry, void*, void*);
+    IOReturn setGeometry(UInt32 newBufferOffsetFactor, UInt32 newNumBlocks);
+    
+    static void statisticsTimerFired(OSObject *target, IOTimerEventSource *sender);
+    void publishStatistics();
+    static void setDictionaryNumber(OSDictionary *dict, const char *key, UInt64 value);
+    static void setDictionaryHistogram(OSDictionary *dict, const char *key, const UInt64 *histogram);
+    static void setDictionaryArray(OSDictionary *dict, const char *key, const UInt64 *values, UInt32 count);
     
     virtual bool initControls();
     
@@ -37,6 +37,27 @@
 
 #define REAC_CONNECTION_CHECK_TIMEOUT_MS 500
 #define REAC_TIMEOUT_UNTIL_DISCONNECT 1000
+#define REAC_MAX_REORDER_WINDOW 32
+#define REAC_TX_LATENCY_FILTER_SHIFT 4 // The TX latency filter moves 1/16 of the way to each new measurement
+#define REAC_MAX_SPIN_BUDGET_US 100
+#define REAC_SPIN_JITTER_FACTOR 4 // How many times the filtered wakeup jitter to spin for
+#define REAC_IDLE_DELAY_MS 2000 // How long a connection has to be unused before going idle
+
+#define REAC_CALENDAR_MAX_SLEW_NS 10000 // Per second
+#define REAC_CALENDAR_STEP_NS 10000000  // Larger differences are taken as a step of the calendar clock
+
+static const UInt64 txJitterBucketLimitsNS[REAC_HISTOGRAM_BUCKETS-1] = {
+    1000, 2000, 5000, 10000, 20000, 50000, 100000
+};
+static const UInt64 interArrivalBucketLimitsNS[REAC_HISTOGRAM_BUCKETS-1] = {
+    50000, 100000, 150000, 250000, 500000, 1000000, 2000000
+};
+static const UInt64 timerLatenessBucketLimitsNS[REAC_HISTOGRAM_BUCKETS-1] = {
+    10000, 20000, 50000, 100000, 200000, 500000, 1000000
+};
+static const UInt64 lossBurstBucketLimits[REAC_HISTOGRAM_BUCKETS-1] = {
+    2, 3, 5, 9, 17, 65, 801
+};
 
 #define super OSObject
 
@@ -51,6 +72,12 @@ bool REACConnection::initWithInterface(IOWorkLoop *workLoop_, ifnet_t interface_
                                        UInt8 inChannels_,
                                        UInt8 outChannels_) {
     dataStream = NULL;
+    impairment = NULL;
+    reorderWindow = 0;
+    lostCounters = 0;
+    seenCounters = 0;
+    lossBurst = 0;
+    memset(&stats, 0, sizeof(stats));
     deviceInfo = NULL;
     filterCommandGate = NULL;
     workLoop = NULL;
@@ -98,6 +125,18 @@ bool REACConnection::initWithInterface(IOWorkLoop *workLoop_, ifnet_t interface_
     connected = false;
     
     lastCounter = 0;
+    lastArrivalTimeNS = 0;
+    wakeTime = 0;
+    lastTxTimeNS = 0;
+    txLatencyNS = 0;
+    spinBudgetNS = 0;
+    wakeLatenessNS = 0;
+    wakeJitterNS = 0;
+    gridPacket = 0;
+    packetsSinceCalendarCheck = 0;
+    idleState = REAC_RUNNING;
+    inUse = false;
+    unusedNS = 0;
     lastSeenConnectionCounter = 0;
     lastSentAnnouncementCounter = 0;
     splitAnnouncementCounter = 0;
@@ -180,6 +219,11 @@ void REACConnection::deinit() {
         dataStream = NULL;
     }
     
+    if (NULL != impairment) {
+        impairment->release();
+        impairment = NULL;
+    }
+    
     if (NULL != deviceInfo) {
         IOFree(deviceInfo, sizeof(REACDeviceInfo));
     }
@@ -190,10 +234,6 @@ void REACConnection::deinit() {
         filterCommandGate = NULL;
     }
     
-    if (NULL != workLoop) {
-        workLoop->release();
-    }
-    
     if (NULL != timerEventSource) {
         timerEventSource->cancelTimeout();
         workLoop->removeEventSource(timerEventSource);
@@ -201,6 +241,12 @@ void REACConnection::deinit() {
         timerEventSource = NULL;
     }
     
+    // The event sources have to be removed from the work loop before it is released
+    if (NULL != workLoop) {
+        workLoop->release();
+        workLoop = NULL;
+    }
+    
     if (NULL != interface) {
         ifnet_release(interface);
         interface = NULL;
@@ -219,13 +265,13 @@ bool REACConnection::start() {
         return false;
     }
     
-    
-    timerEventSource->setTimeout(timeoutNS);
-    
-    uint64_t time;
-    clock_get_uptime(&time);
-    absolutetime_to_nanoseconds(time, &nextTime);
-    nextTime += timeoutNS;
+    lastArrivalTimeNS = 0;
+    txLatencyNS = 0;
+    wakeLatenessNS = 0;
+    wakeJitterNS = 0;
+    idleState = REAC_RUNNING;
+    unusedNS = 0;
+    scheduleFirstTimeout();
         
     iff_filter filter;
     filter.iff_cookie = this;
@@ -241,6 +287,8 @@ bool REACConnection::start() {
         return false;
     }
     
+    memset(&stats, 0, sizeof(stats));
+    
     started = true;
     
     return true;
@@ -262,7 +310,156 @@ void REACConnection::stop() {
         
         iflt_detach(filterRef);
         started = false;
+        
+        IOLog("REACConnection[%p]::stop(): %lld packets lost, %lld reordered, %lld too late, %lld duplicates\n",
+              this, stats.lostPackets, stats.reorderedPackets, stats.latePackets, stats.duplicatePackets);
+        IOLog("REACConnection[%p]::stop(): Loss burst histogram %lld %lld %lld %lld %lld %lld %lld %lld, longest %lld packets\n",
+              this, stats.lossBursts[0], stats.lossBursts[1], stats.lossBursts[2], stats.lossBursts[3],
+              stats.lossBursts[4], stats.lossBursts[5], stats.lossBursts[6], stats.lossBursts[7], stats.longestLossBurst);
+        if (REAC_MASTER == mode) {
+            IOLog("REACConnection[%p]::stop(): TX jitter histogram %lld %lld %lld %lld %lld %lld %lld %lld, TX latency %lld us, spin time %lld ms\n",
+                  this, stats.txJitter[0], stats.txJitter[1], stats.txJitter[2], stats.txJitter[3],
+                  stats.txJitter[4], stats.txJitter[5], stats.txJitter[6], stats.txJitter[7], txLatencyNS/1000,
+                  stats.spinTimeNS/1000000);
+        }
+        if (NULL != impairment) {
+            // The impairment stage is used by packets on the work loop, which may still be
+            // on their way through when the filter is detached.
+            runAction(&REACConnection::flushImpairmentAction);
+        }
+    }
+}
+
+IOReturn REACConnection::flushImpairmentAction(OSObject *owner, void*, void*, void*, void*) {
+    REACConnection *proto = (REACConnection *)owner;
+    proto->impairment->flush();
+    proto->impairment->logStatistics(proto);
+    return kIOReturnSuccess;
+}
+
+void REACConnection::setReorderWindow(UInt32 packets) {
+    if (started) {
+        IOLog("REACConnection[%p]::setReorderWindow(): Can't change reorder window while started.\n", this);
+        return;
+    }
+    
+    if (packets > REAC_MAX_REORDER_WINDOW) {
+        IOLog("REACConnection[%p]::setReorderWindow(): Reorder window %d is too big, using %d.\n",
+              this, (int) packets, REAC_MAX_REORDER_WINDOW);
+        packets = REAC_MAX_REORDER_WINDOW;
+    }
+    reorderWindow = packets;
+}
+
+void REACConnection::gotReorderedPacket(UInt64 age) {
+    // Only a packet that was counted as lost when it was skipped makes up for that loss.
+    // Anything else, like a second copy of a packet, is not a reordering.
+    if (age < 64 && (lostCounters & (1ULL << age))) {
+        lostCounters &= ~(1ULL << age);
+        stats.lostPackets--;
+        stats.reorderedPackets++;
+    }
+}
+
+void REACConnection::setSpinBudget(UInt32 budgetUS) {
+    if (started) {
+        IOLog("REACConnection[%p]::setSpinBudget(): Can't change spin budget while started.\n", this);
+        return;
+    }
+    
+    if (budgetUS > REAC_MAX_SPIN_BUDGET_US) {
+        IOLog("REACConnection[%p]::setSpinBudget(): Spin budget %d us is too big, using %d us.\n",
+              this, (int) budgetUS, REAC_MAX_SPIN_BUDGET_US);
+        budgetUS = REAC_MAX_SPIN_BUDGET_US;
+    }
+    spinBudgetNS = (UInt64)budgetUS*1000;
+}
+
+void REACConnection::setInUse(bool inUse_) {
+    inUse = inUse_;
+    if (inUse_) {
+        wakeUp();
+    }
+}
+
+void REACConnection::scheduleFirstTimeout() {
+    UInt64 uptimeNS;
+    SInt64 calendarOffsetNS;
+    getUptimeAndCalendarOffset(&uptimeNS, &calendarOffsetNS);
+    if (REAC_MASTER == mode) {
+        // Send packet N at calendar time N*timeoutNS, with N as its counter. This keeps
+        // masters on different computers with synchronized clocks in phase.
+        gridPacket = (uptimeNS+calendarOffsetNS)/timeoutNS + 1;
+        nextTime = gridPacket*timeoutNS - calendarOffsetNS;
+        dataStream->setNextCounter(gridPacket);
+    }
+    else {
+        nextTime = uptimeNS+timeoutNS;
+    }
+    packetsSinceCalendarCheck = 0;
+    lastTxTimeNS = 0;
+    
+    wakeTime = nextTime;
+    timerEventSource->setTimeout(nextTime-uptimeNS);
+}
+
+bool REACConnection::goIdleIfUnused(UInt32 packets) {
+    if (inUse || connected) {
+        unusedNS = 0;
+        return false;
+    }
+    
+    unusedNS += (UInt64)packets*timeoutNS;
+    if (unusedNS < (UInt64)REAC_IDLE_DELAY_MS*1000000) {
+        return false;
+    }
+    
+    OSCompareAndSwap(REAC_RUNNING, REAC_IDLE, &idleState);
+    // A client may have started using the connection while going idle. Whoever moves the
+    // state away from REAC_IDLE is the one that takes care of the timer.
+    __sync_synchronize();
+    if (inUse && OSCompareAndSwap(REAC_IDLE, REAC_RUNNING, &idleState)) {
+        unusedNS = 0;
+        return false;
+    }
+    return true;
+}
+
+void REACConnection::wakeUp() {
+    __sync_synchronize();
+    if (OSCompareAndSwap(REAC_IDLE, REAC_WAKING, &idleState)) {
+        // timerFired picks up from here, on the work loop
+        timerEventSource->setTimeoutUS(0);
+    }
+}
+
+void REACConnection::setImpairment(REACImpairment *impairment_) {
+    if (started) {
+        IOLog("REACConnection[%p]::setImpairment(): Can't change impairment while started.\n", this);
+        return;
+    }
+    
+    if (NULL != impairment_) {
+        impairment_->retain();
+    }
+    if (NULL != impairment) {
+        impairment->release();
+    }
+    impairment = impairment_;
+}
+
+IOReturn REACConnection::setChannelGain(UInt32 channel, UInt8 gain) {
+    // The pending channel info is sent and cleared on the work loop
+    return runAction(&REACConnection::setChannelGainAction, (void *)(uintptr_t)channel, (void *)(uintptr_t)gain);
+}
+
+IOReturn REACConnection::setChannelGainAction(OSObject *owner, void *channel, void *gain, void*, void*) {
+    REACConnection *proto = (REACConnection *)owner;
+    REACMasterDataStream *masterDataStream = OSDynamicCast(REACMasterDataStream, proto->dataStream);
+    if (NULL == masterDataStream) {
+        return kIOReturnUnsupported;
     }
+    return masterDataStream->setChannelGain((UInt32)(uintptr_t)channel, (UInt8)(uintptr_t)gain);
 }
 
 const REACDeviceInfo *REACConnection::getDeviceInfo() const {
@@ -278,8 +475,40 @@ void REACConnection::timerFired(OSObject *target, IOTimerEventSource *sender) {
     }
     
     UInt64            thisTimeNS;
+    UInt64            startNS;
     uint64_t          time;
     SInt64            diff;
+    UInt32            packets = 0;
+    
+    if (REAC_WAKING == proto->idleState) {
+        // Start over on the packet grid, as if the connection was just started
+        proto->unusedNS = 0;
+        proto->scheduleFirstTimeout();
+        OSCompareAndSwap(REAC_WAKING, REAC_RUNNING, &proto->idleState);
+        return;
+    }
+    
+    clock_get_uptime(&time);
+    absolutetime_to_nanoseconds(time, &thisTimeNS);
+    if (thisTimeNS > proto->wakeTime) {
+        addToHistogram(proto->stats.timerLateness, timerLatenessBucketLimitsNS, thisTimeNS-proto->wakeTime);
+    }
+    else {
+        proto->stats.timerLateness[0]++;
+    }
+    
+    startNS = proto->wakeTime;
+    if (REAC_MASTER == proto->mode && 0 != proto->spinBudgetNS) {
+        // Keep track of how late and how unevenly the timer wakes up, to know how early
+        // it has to be set to be awake before the packet is due.
+        diff = (SInt64)thisTimeNS - (SInt64)proto->wakeTime;
+        proto->wakeLatenessNS += (diff - proto->wakeLatenessNS) >> REAC_TX_LATENCY_FILTER_SHIFT;
+        diff -= proto->wakeLatenessNS;
+        proto->wakeJitterNS += ((diff < 0 ? -diff : diff) - proto->wakeJitterNS) >> REAC_TX_LATENCY_FILTER_SHIFT;
+        
+        startNS = proto->nextTime > (UInt64)proto->txLatencyNS ? proto->nextTime-proto->txLatencyNS : 0;
+        thisTimeNS = proto->spinUntil(thisTimeNS, startNS);
+    }
     
     do {
         if (proto->isConnected()) {
@@ -295,7 +524,11 @@ void REACConnection::timerFired(OSObject *target, IOTimerEventSource *sender) {
         }
         
         if (REAC_MASTER == proto->mode) {
-            proto->getAndSendSamples();
+            if (kIOReturnSuccess == proto->getAndSendSamples()) {
+                clock_get_uptime(&time);
+                absolutetime_to_nanoseconds(time, &thisTimeNS);
+                proto->gotTxTimestamp(startNS, thisTimeNS);
+            }
         }
         else if (REAC_SPLIT == proto->mode) {
             proto->lastSentAnnouncementCounter++;
@@ -309,6 +542,11 @@ void REACConnection::timerFired(OSObject *target, IOTimerEventSource *sender) {
         clock_get_uptime(&time);
         absolutetime_to_nanoseconds(time, &thisTimeNS);
         proto->nextTime += proto->timeoutNS;
+        packets++;
+        if (REAC_MASTER == proto->mode) {
+            proto->followCalendarTime();
+        }
+        startNS = proto->nextTime;
         // This next calculation must be signed
         diff = ((SInt64)proto->nextTime - (SInt64)thisTimeNS);
         
@@ -317,9 +555,141 @@ void REACConnection::timerFired(OSObject *target, IOTimerEventSource *sender) {
             IOLog("REACConnection::timerFired(): Lost the time by %lld us\n", diff/1000);
         }
     } while (diff < 0);
+    // Wake up early by the time it usually takes from the wakeup until the packet is out,
+    // so that packets leave as close to their due time as possible.
+    const SInt64 earlyNS = proto->txLatencyNS + (SInt64)proto->getSpinWindowNS();
+    diff = diff > earlyNS ? diff-earlyNS : 0;
+    if (proto->goIdleIfUnused(packets)) {
+        IOLog("REACConnection[%p]::timerFired(): Unused, going idle.\n", proto);
+        return;
+    }
+    proto->wakeTime = thisTimeNS+diff;
     sender->setTimeout(diff);
 }
 
+void REACConnection::getUptimeAndCalendarOffset(UInt64 *uptimeNS, SInt64 *calendarOffsetNS) {
+    clock_sec_t secs;
+    clock_nsec_t nanosecs;
+    uint64_t time;
+    
+    clock_get_calendar_nanotime(&secs, &nanosecs);
+    clock_get_uptime(&time);
+    absolutetime_to_nanoseconds(time, uptimeNS);
+    
+    *calendarOffsetNS = (SInt64)secs*1000000000 + nanosecs - (SInt64)*uptimeNS;
+}
+
+void REACConnection::followCalendarTime() {
+    gridPacket++;
+    
+    if (++packetsSinceCalendarCheck < REAC_PACKETS_PER_SECOND) {
+        return;
+    }
+    packetsSinceCalendarCheck = 0;
+    
+    UInt64 uptimeNS;
+    SInt64 calendarOffsetNS;
+    getUptimeAndCalendarOffset(&uptimeNS, &calendarOffsetNS);
+    SInt64 error = (SInt64)nextTime + calendarOffsetNS - (SInt64)(gridPacket*timeoutNS);
+    
+    if (error > REAC_CALENDAR_STEP_NS || error < -REAC_CALENDAR_STEP_NS) {
+        // Slewing this would take forever. Move to the closest point of the grid instead,
+        // which keeps the phase but not the relation between counter and calendar time.
+        IOLog("REACConnection[%p]::followCalendarTime(): Calendar time stepped by %lld us\n", this, error/1000);
+        gridPacket = (nextTime+calendarOffsetNS+timeoutNS/2)/timeoutNS;
+        nextTime = gridPacket*timeoutNS - calendarOffsetNS;
+        return;
+    }
+    
+    if (error > REAC_CALENDAR_MAX_SLEW_NS) {
+        error = REAC_CALENDAR_MAX_SLEW_NS;
+    }
+    else if (error < -REAC_CALENDAR_MAX_SLEW_NS) {
+        error = -REAC_CALENDAR_MAX_SLEW_NS;
+    }
+    nextTime -= error;
+}
+
+UInt64 REACConnection::getSpinWindowNS() const {
+    if (REAC_MASTER != mode || 0 == spinBudgetNS) {
+        return 0;
+    }
+    
+    UInt64 window = (UInt64)wakeJitterNS*REAC_SPIN_JITTER_FACTOR;
+    if (window > spinBudgetNS) {
+        window = spinBudgetNS;
+    }
+    return window + (wakeLatenessNS > 0 ? wakeLatenessNS : 0);
+}
+
+UInt64 REACConnection::spinUntil(UInt64 nowNS, UInt64 targetNS) {
+    const UInt64 spinStartNS = nowNS;
+    uint64_t time;
+    
+    while (nowNS < targetNS && nowNS-spinStartNS < spinBudgetNS) {
+        clock_get_uptime(&time);
+        absolutetime_to_nanoseconds(time, &nowNS);
+    }
+    stats.spinTimeNS += nowNS-spinStartNS;
+    return nowNS;
+}
+
+void REACConnection::gotTxTimestamp(UInt64 startNS, UInt64 txTimeNS) {
+    const SInt64 latency = (SInt64)txTimeNS - (SInt64)startNS;
+    // Catching up after a stall says nothing about the wakeup latency, so those packets
+    // are left out of the filter rather than pulling it towards a whole packet period.
+    if (latency <= (SInt64)timeoutNS) {
+        txLatencyNS += (latency - txLatencyNS) >> REAC_TX_LATENCY_FILTER_SHIFT;
+        if (txLatencyNS < 0) {
+            txLatencyNS = 0;
+        }
+    }
+    
+    if (0 != lastTxTimeNS) {
+        const SInt64 periodError = (SInt64)(txTimeNS - lastTxTimeNS) - (SInt64)timeoutNS;
+        addToHistogram(stats.txJitter, txJitterBucketLimitsNS, periodError < 0 ? -periodError : periodError);
+    }
+    lastTxTimeNS = txTimeNS;
+}
+
+void REACConnection::addToHistogram(UInt64 *histogram, const UInt64 *bucketLimits, UInt64 value) {
+    UInt32 bucket = 0;
+    while (bucket < REAC_HISTOGRAM_BUCKETS-1 && value >= bucketLimits[bucket]) {
+        bucket++;
+    }
+    histogram[bucket]++;
+}
+
+void REACConnection::countLossBursts(SInt64 packetOffset) {
+    // The number of ages a packet is accepted at, counting the newest packet as age 0
+    const SInt64 window = (SInt64)reorderWindow+1;
+    
+    // Packets in the window that become too old to be accepted, oldest first
+    for (SInt64 age = window-1; age >= 0 && age >= window-(packetOffset+1); age--) {
+        if (seenCounters & (1ULL << age)) {
+            endLossBurst();
+        }
+        else {
+            lossBurst++;
+        }
+    }
+    
+    // The skipped packets that are already too old, that is all but the newest window-1
+    if (packetOffset >= window) {
+        lossBurst += packetOffset-window+1;
+    }
+}
+
+void REACConnection::endLossBurst() {
+    if (0 != lossBurst) {
+        addToHistogram(stats.lossBursts, lossBurstBucketLimits, lossBurst);
+        if (lossBurst > stats.longestLossBurst) {
+            stats.longestLossBurst = lossBurst;
+        }
+        lossBurst = 0;
+    }
+}
+
 IOReturn REACConnection::getAndSendSamples() {
     UInt8 *sampleBuffer = NULL;
     UInt32 bufSize = 0;
@@ -526,89 +896,174 @@ void REACConnection::filterCommandGateMsg(OSObject *target, void *data_mbuf, voi
         return;
     }
     
+    mbuf_t data = *((mbuf_t *)data_mbuf);
     const EthernetHeader *ethernetHeader = (const EthernetHeader *)eth_header_ptr;
-    const int samplesSize = REAC_SAMPLES_PER_PACKET*REAC_RESOLUTION*proto->deviceInfo->in_channels;
     
-    mbuf_t *data = (mbuf_t *)data_mbuf;
-    UInt32 len = MbufUtils::mbufTotalLength(*data);
+    if (REAC_IDLE == proto->idleState) {
+        proto->wakeUp();
+    }
+    
+    if (NULL == proto->impairment) {
+        proto->gotPacket(data, ethernetHeader);
+        return;
+    }
+    
+    // Deliver the packet as many times as the impairment stage says, then any
+    // previously held back packets that are due.
+    UInt32 times = proto->impairment->admit(data, ethernetHeader);
+    for (UInt32 i=0; i<times; i++) {
+        proto->gotPacket(data, ethernetHeader);
+    }
+    
+    mbuf_t heldData;
+    EthernetHeader heldHeader;
+    while (proto->impairment->takeDuePacket(&heldData, &heldHeader)) {
+        proto->gotPacket(heldData, &heldHeader);
+        mbuf_freem(heldData);
+    }
+}
+
+void REACConnection::gotPacket(mbuf_t data, const EthernetHeader *ethernetHeader) {
+    UInt64 arrivalTimeNS;
+    uint64_t time;
+    clock_get_uptime(&time);
+    absolutetime_to_nanoseconds(time, &arrivalTimeNS);
+    
+    const int samplesSize = REAC_SAMPLES_PER_PACKET*REAC_RESOLUTION*deviceInfo->in_channels;
+    
+    UInt32 len = MbufUtils::mbufTotalLength(data);
     REACPacketHeader packetHeader;
     
     // Check that the packet length is long enough
     if (len < sizeof(REACPacketHeader)+sizeof(REACConstants::ENDING)) {
-        IOLog("REACConnection[%p]::filterCommandGateMsg(): Got packet of too short length\n", proto);
+        IOLog("REACConnection[%p]::gotPacket(): Got packet of too short length\n", this);
         return;
     }
         
     // Check packet ending
     UInt8 packetEnding[sizeof(REACConstants::ENDING)];
-    if (0 != mbuf_copydata(*data, len-sizeof(REACConstants::ENDING), sizeof(REACConstants::ENDING), &packetEnding)) {
-        IOLog("REACConnection[%p]::filterCommandGateMsg(): Failed to fetch REAC packet ending\n", proto);
+    if (0 != mbuf_copydata(data, len-sizeof(REACConstants::ENDING), sizeof(REACConstants::ENDING), &packetEnding)) {
+        IOLog("REACConnection[%p]::gotPacket(): Failed to fetch REAC packet ending\n", this);
         return;
     }
     if (0 != memcmp(packetEnding, REACConstants::ENDING, sizeof(packetEnding))) {
         // Incorrect ending. Not a REAC packet?
-        IOLog("REACConnection[%p]::filterCommandGateMsg(): Incorrect packet ending.\n", proto);
+        IOLog("REACConnection[%p]::gotPacket(): Incorrect packet ending.\n", this);
         return;
     }
     
     // Fetch packet header
-    if (0 != mbuf_copydata(*data, 0, sizeof(REACPacketHeader), &packetHeader)) {
-        IOLog("REACConnection[%p]::filterCommandGateMsg(): Failed to fetch REAC packet header\n", proto);
+    if (0 != mbuf_copydata(data, 0, sizeof(REACPacketHeader), &packetHeader)) {
+        IOLog("REACConnection[%p]::gotPacket(): Failed to fetch REAC packet header\n", this);
         return;
     }
     
+    stats.packets++;
+    if (0 != lastArrivalTimeNS) {
+        addToHistogram(stats.interArrival, interArrivalBucketLimitsNS, arrivalTimeNS-lastArrivalTimeNS);
+    }
+    lastArrivalTimeNS = arrivalTimeNS;
+    
     // Check packet counter
     // TODO This doesn't work when more than one unit (for instance two splits) is connected
-    if (proto->isConnected() && /* This prunes a lost packet message when connecting */
-        proto->lastCounter+1 != packetHeader.getCounter()) {
-        if (!(65535 == proto->lastCounter && 0 == packetHeader.getCounter())) {
-            IOLog("REACConnection[%p]::filterCommandGateMsg(): Lost packet [%d %d]\n",
-                  proto, proto->lastCounter, packetHeader.getCounter());
+    const UInt64 packetCounter = packetHeader.getExtendedCounter(lastCounter);
+    SInt64 packetOffset = 0;
+    if (isConnected()) { /* This prunes a lost packet message when connecting */
+        packetOffset = (SInt64)packetCounter - (SInt64)(lastCounter+1);
+        if (packetOffset < 0) {
+            // Drop packets that have already been seen before they are processed at all.
+            const UInt64 age = lastCounter-packetCounter;
+            if (age < 64) {
+                if (seenCounters & (1ULL << age)) {
+                    stats.duplicatePackets++;
+                    return;
+                }
+                seenCounters |= 1ULL << age;
+            }
+        }
+        else {
+            countLossBursts(packetOffset);
+            seenCounters = (packetOffset >= 63 ? 0 : seenCounters << (packetOffset+1)) | 1;
+            // Assume that the packets in between are lost, until they show up
+            lostCounters = packetOffset >= 63 ? ~1ULL :
+                (lostCounters << (packetOffset+1)) | (((1ULL << packetOffset)-1) << 1);
         }
+        
+        if (packetOffset > 0) {
+            stats.lostPackets += packetOffset;
+            IOLog("REACConnection[%p]::gotPacket(): Lost packet [%lld %lld]\n",
+                  this, lastCounter, packetCounter);
+        }
+        else if (packetOffset < 0) {
+            // The packet is lastCounter-packetCounter packets late
+            if (lastCounter-packetCounter > reorderWindow) {
+                stats.latePackets++;
+                IOLog("REACConnection[%p]::gotPacket(): Dropped late packet [%lld %lld]\n",
+                      this, lastCounter, packetCounter);
+                return;
+            }
+        }
+    }
+    else {
+        lostCounters = 0;
+        // Packets from before the connection count as seen
+        seenCounters = ~0ULL;
+        lossBurst = 0;
+        // Make lastCounter+1+packetOffset the counter of this packet for the samples callback
+        lastCounter = packetCounter-1;
     }
     
     // Process packet header
-    proto->dataStream->gotPacket(&packetHeader, ethernetHeader);
+    dataStream->gotPacket(&packetHeader, ethernetHeader);
     
     // Check packet length
     if (sizeof(REACPacketHeader)+samplesSize+sizeof(UInt16) == len) {
         // Hack: Announce connect
-        if (!proto->isConnected()) {
-            proto->connected = true;
-            if (NULL != proto->connectionCallback) {
-                proto->connectionCallback(proto, &proto->cookieA, &proto->cookieB, proto->deviceInfo);
+        if (!isConnected()) {
+            connected = true;
+            if (NULL != connectionCallback) {
+                connectionCallback(this, &cookieA, &cookieB, deviceInfo);
             }
         }
         
         // Save the time we got the packet, for use by REACConnection::timerFired
-        proto->lastSeenConnectionCounter = proto->connectionCounter;
+        lastSeenConnectionCounter = connectionCounter;
         
-        if (proto->isConnected()) {
-            if (NULL != proto->samplesCallback) {
+        if (isConnected()) {
+            if (NULL != samplesCallback) {
                 UInt8* inBuffer = NULL;
                 UInt32 inBufferSize = 0;
-                proto->samplesCallback(proto, &proto->cookieA, &proto->cookieB, &inBuffer, &inBufferSize);
+                samplesCallback(this, &cookieA, &cookieB, (SInt32)packetOffset, &inBuffer, &inBufferSize);
                 
                 if (NULL != inBuffer) {
-                    const UInt32 bytesPerSample = REAC_RESOLUTION * proto->deviceInfo->in_channels;
+                    const UInt32 bytesPerSample = REAC_RESOLUTION * deviceInfo->in_channels;
                     const UInt32 bytesPerPacket = bytesPerSample * REAC_SAMPLES_PER_PACKET;
                     
                     if (inBufferSize != bytesPerPacket) {
-                        IOLog("REACConnection::filterCommandGateMsg(): Got incorrectly sized buffer (not the same as a packet).\n");
+                        IOLog("REACConnection::gotPacket(): Got incorrectly sized buffer (not the same as a packet).\n");
                     }
                     else {
-                        MbufUtils::copyAudioFromMbufToBuffer(*data, sizeof(REACPacketHeader), inBufferSize, inBuffer);
+                        MbufUtils::copyAudioFromMbufToBuffer(data, sizeof(REACPacketHeader), inBufferSize, inBuffer);
+                        if (packetOffset < 0) {
+                            gotReorderedPacket(lastCounter-packetCounter);
+                        }
                     }
                 }
+                else if (packetOffset < 0) {
+                    // The engine has already passed the block the packet belongs in
+                    stats.latePackets++;
+                }
             }
         }
     }
     
-    if (REAC_SLAVE == proto->mode) {
-        proto->getAndSendSamples();
+    if (REAC_SLAVE == mode) {
+        getAndSendSamples();
     }
     
-    proto->lastCounter = packetHeader.getCounter();
+    if (packetOffset >= 0) {
+        lastCounter = packetCounter;
+    }
 }
 
 
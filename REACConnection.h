@@ -34,17 +34,23 @@
 #include <net/kpi_interfacefilter.h>
 
 #include "REACDataStream.h"
+#include "REACImpairment.h"
 #include "REACConstants.h"
 #include "EthernetHeader.h"
 
 #define REACConnection              com_pereckerdal_driver_REACConnection
 
+#define REAC_HISTOGRAM_BUCKETS      8
+
 class REACConnection;
 
 // Device is NULL on disconnect
 typedef void(*reac_connection_callback_t)(REACConnection *proto, void **cookieA, void **cookieB, REACDeviceInfo *device);
-// Is only called when the connection callback has indicated that there is a connection
-typedef void(*reac_samples_callback_t)(REACConnection *proto, void **cookieA, void **cookieB, UInt8 **data, UInt32 *bufferSize);
+// Is only called when the connection callback has indicated that there is a connection.
+// packetOffset is the position of the packet relative to the one that was expected next:
+// 0 when the packet is in order, n when n packets before it are missing, and -n when
+// the packet arrived n packets late (it belongs in a slot that has already been passed).
+typedef void(*reac_samples_callback_t)(REACConnection *proto, void **cookieA, void **cookieB, SInt32 packetOffset, UInt8 **data, UInt32 *bufferSize);
 // Is only called when in REAC_MASTER or REAC_SLAVE mode and the connection callback has
 // indicated that there is a connection.
 typedef void(*reac_get_samples_callback_t)(REACConnection *proto, void **cookieA, void **cookieB, UInt8 **data, UInt32 *bufferSize);
@@ -88,6 +94,42 @@ public:
     bool start();
     void stop();
     
+    // Sets how many packets late a packet may arrive and still be written to its place
+    // in the input ring. Later packets are dropped. The window adds to the input latency,
+    // as the engine has to stay that far behind the newest packet. Can only be called
+    // when the connection is not started.
+    void setReorderWindow(UInt32 packets);
+    UInt32 getReorderWindow() const { return reorderWindow; }
+    
+    // Makes incoming packets pass through an impairment stage before they are
+    // processed. This is for testing only. Pass NULL to remove it. Can only be
+    // called when the connection is not started.
+    void setImpairment(REACImpairment *impairment);
+    
+    // In REAC_MASTER mode, makes the timer wake up a little before a packet is due and
+    // busy-wait for the rest, for at most budgetUS microseconds per packet. This trades
+    // CPU time for lower jitter in when packets are sent. The part of the budget that is
+    // used adapts to how much the timer wakeup varies. 0 turns it off, which is the
+    // default. Can only be called when the connection is not started.
+    void setSpinBudget(UInt32 budgetUS);
+    
+    // Tells the connection whether an audio client is using it. When no client is and no
+    // packets have arrived from a peer for a while, the connection goes idle: its timer
+    // stops, so nothing is sent until it wakes up again. It wakes up on the next packet
+    // or when a client starts using it. Can be called from any thread.
+    void setInUse(bool inUse);
+    bool isIdle() const { return REAC_RUNNING != idleState; }
+    
+    // Runs action on the connection's work loop, between two packets. The owner argument
+    // of action is the connection. Every connection has a work loop of its own, so do not
+    // call this while holding another command gate that the connection's callbacks take.
+    // The connection callback only takes the device's gate while there is no audio engine,
+    // so the engine may call this with its gate held.
+    IOReturn runAction(IOCommandGate::Action action, void *arg0 = 0, void *arg1 = 0,
+                       void *arg2 = 0, void *arg3 = 0) {
+        return filterCommandGate->runAction(action, arg0, arg1, arg2, arg3);
+    }
+    
     const REACDeviceInfo *getDeviceInfo() const;
     bool isStarted() const { return started; }
     bool isConnected() const { return connected; }
@@ -106,14 +148,65 @@ public:
     }
     UInt8 getInChannels() const { return inChannels; }
     UInt8 getOutChannels() const { return outChannels; }
+    // The extended (64 bit) counter of the last received packet.
+    UInt64 getLastCounter() const { return lastCounter; }
+    // The counter of the last packet that was sent.
+    UInt64 getLastSentCounter() const { return dataStream->getCounter(); }
+    // The number of received packets with a bad checksum.
+    UInt64 getChecksumErrors() const { return dataStream->getChecksumErrors(); }
+    // The channel layout of the REAC network. See REACTopology.
+    void getTopology(REACTopology *topology) const { dataStream->getTopology(topology); }
+    // Sets the gain of a channel on the REAC network. Only works in REAC_MASTER mode. The
+    // change is made on the connection's work loop; see runAction.
+    IOReturn setChannelGain(UInt32 channel, UInt8 gain);
+    
+    // Counters for the incoming packet stream. They are reset when the connection is started.
+    struct Statistics {
+        UInt64 packets;             // Packets that were received, including dropped ones
+        UInt64 lostPackets;         // Packets that were skipped and never arrived within the reorder window
+        UInt64 reorderedPackets;    // Packets that arrived late but within the reorder window
+        UInt64 latePackets;         // Packets that arrived too late, and were dropped
+        UInt64 duplicatePackets;    // Packets whose counter had already been seen, and were dropped
+        // Histogram of how far the time between two sent packets is from the packet period
+        // in REAC_MASTER mode, in buckets of <1, <2, <5, <10, <20, <50, <100 and >=100 us.
+        UInt64 txJitter[REAC_HISTOGRAM_BUCKETS];
+        // Histogram of the time between two received packets, in buckets of <50, <100, <150,
+        // <250, <500, <1000, <2000 and >=2000 us.
+        UInt64 interArrival[REAC_HISTOGRAM_BUCKETS];
+        // Histogram of how late the timer fires, in buckets of <10, <20, <50, <100, <200,
+        // <500, <1000 and >=1000 us.
+        UInt64 timerLateness[REAC_HISTOGRAM_BUCKETS];
+        UInt64 spinTimeNS;          // Total time spent busy-waiting for packets to be due (see setSpinBudget)
+        // Histogram of the lengths of runs of consecutive lost packets, in buckets of 1, 2,
+        // 3-4, 5-8, 9-16, 17-64, 65-800 and >800 packets. A run is counted once the reorder
+        // window has passed it.
+        UInt64 lossBursts[REAC_HISTOGRAM_BUCKETS];
+        UInt64 longestLossBurst;    // In packets
+    };
+    const Statistics &getStatistics() const { return stats; }
 
 protected:
+    enum IdleState {
+        REAC_RUNNING, REAC_IDLE, REAC_WAKING
+    };
+    
     // IOKit handles
     IOWorkLoop         *workLoop;
     IOTimerEventSource *timerEventSource;        // Note that the timer runs faster when in REAC_MASTER mode than otherwise
     IOCommandGate      *filterCommandGate;
     UInt64              timeoutNS;
     UInt64              nextTime;                // the estimated time the timer will fire next
+    UInt64              wakeTime;                // the time the timer was asked to fire next
+    UInt64              lastTxTimeNS;            // When the last packet was sent in REAC_MASTER mode
+    SInt64              txLatencyNS;             // Filtered delay from when the timer aims to start sending a packet until it is sent
+    UInt64              spinBudgetNS;            // See setSpinBudget
+    SInt64              wakeLatenessNS;          // Filtered time from wakeTime until the timer actually fires
+    SInt64              wakeJitterNS;            // Filtered deviation of the timer wakeup from wakeLatenessNS
+    UInt64              gridPacket;              // In REAC_MASTER mode, the packet that is due at nextTime is due at calendar time gridPacket*timeoutNS
+    UInt32              packetsSinceCalendarCheck;
+    volatile UInt32     idleState;               // An IdleState. Only changed with OSCompareAndSwap
+    volatile bool       inUse;                   // See setInUse
+    UInt64              unusedNS;                // How long the connection has been unused, for going idle
     
     // Network handles
     UInt8               interfaceAddr[ETHER_ADDR_LEN];
@@ -140,17 +233,53 @@ protected:
     bool                started;
     bool                connected;
     REACDataStream     *dataStream;
+    REACImpairment     *impairment; // NULL unless packet impairment is enabled
+    UInt32              reorderWindow; // In packets
+    UInt64              lostCounters; // Bit n is set if the packet with counter lastCounter-n was skipped and counted as lost
+    UInt64              seenCounters; // Bit n is set if the packet with counter lastCounter-n has been seen
+    UInt64              lossBurst;    // The length of the current run of lost packets that have passed the reorder window
+    Statistics          stats;
     REACDeviceInfo     *deviceInfo;
-    UInt16              lastCounter; // Tracks input REAC counter
+    UInt64              lastCounter; // Tracks the highest input REAC counter, extended to 64 bits (see REACPacketHeader::getExtendedCounter)
+    UInt64              lastArrivalTimeNS; // The uptime when the last packet arrived
     
     static void timerFired(OSObject *target, IOTimerEventSource *sender);
+    // Sets nextTime to the next packet period and arms the timer for it.
+    void scheduleFirstTimeout();
+    // Called by the timer when it would be armed again, with the number of packet periods
+    // it has handled since the last call. Returns true if the connection went idle, in
+    // which case the timer should not be armed.
+    bool goIdleIfUnused(UInt32 packets);
+    // Makes an idle connection start its timer again.
+    void wakeUp();
     
     IOReturn getAndSendSamples();
+    // Returns the current uptime and the difference between calendar time and uptime.
+    static void getUptimeAndCalendarOffset(UInt64 *uptimeNS, SInt64 *calendarOffsetNS);
+    // Called for each packet period in REAC_MASTER mode. Slowly steers nextTime
+    // towards the calendar time packet grid.
+    void followCalendarTime();
+    // Feeds the pacing of REAC_MASTER mode with when a packet was sent. startNS is when
+    // the timer aimed to start sending it.
+    void gotTxTimestamp(UInt64 startNS, UInt64 txTimeNS);
+    // How much earlier than txLatencyNS the timer has to wake up to leave room for spinning.
+    UInt64 getSpinWindowNS() const;
+    // Busy-waits from nowNS until targetNS, but at most spinBudgetNS. Returns the time
+    // after waiting.
+    UInt64 spinUntil(UInt64 nowNS, UInt64 targetNS);
+    static void addToHistogram(UInt64 *histogram, const UInt64 *bucketLimits, UInt64 value);
+    // Called for a packet with an offset >= 0 (see reac_samples_callback_t) before seenCounters
+    // is updated. Counts the packets that pass the reorder window into the loss burst statistics.
+    void countLossBursts(SInt64 packetOffset);
+    void endLossBurst();
     // When sampleBuffer is NULL, the sample data will be zeros (and bufSize will be disregarded).
     IOReturn sendSamples(UInt32 bufSize, UInt8 *sampleBuffer);
     IOReturn sendSplitAnnouncementPacket();
     
     static void filterCommandGateMsg(OSObject *target, void *data_mbuf, void *eth_header_ptr, void*, void*);
+    void gotPacket(mbuf_t data, const EthernetHeader *ethernetHeader);
+    // Accounts for a packet that arrived age packets behind lastCounter and was written to the input ring.
+    void gotReorderedPacket(UInt64 age);
     
     static errno_t filterInputFunc(void *cookie,
                                    ifnet_t interface, 
@@ -159,6 +288,8 @@ protected:
                                    char **frame_ptr);        
     static void filterDetachedFunc(void *cookie,
                                    ifnet_t interface);
+    static IOReturn setChannelGainAction(OSObject *owner, void *channel, void *gain, void*, void*);
+    static IOReturn flushImpairmentAction(OSObject *owner, void*, void*, void*, void*);
     static IOReturn getInterfaceMacAddress(ifnet_t interface, UInt8* addr, UInt32 addrLen);
     
 };
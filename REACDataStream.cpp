@@ -63,6 +63,11 @@ bool REACDataStream::initConnection(REACConnection* conn) {
     lastAnnouncePacket = 0;
     counter = 0;
     recievedPacketCounter = 0;
+    checksumErrors = 0;
+    memset(&assemblingTopology, 0, sizeof(assemblingTopology));
+    assemblingFullRound = false;
+    memset(&topology, 0, sizeof(topology));
+    topologySequence = 0;
     
     return true;
 }
@@ -109,10 +114,15 @@ bool REACDataStream::gotPacket(const REACPacketHeader *packet, const EthernetHea
     }
     
     if (!REACDataStream::checkChecksum(packet)) {
+        checksumErrors++;
         IOLog("REACDataStream::gotPacket(): Got packet with invalid checksum.\n");
         return true;
     }
     
+    if (isControlPacketType(packet, CONTROL_PACKET_TYPE_THREE)) {
+        gotChannelInfo(packet);
+    }
+    
     /*IOLog("Got packet: "); // TODO Debug
      for (UInt32 i=0; i<sizeof(REACPacketHeader); i++) {
      IOLog("%02x", ((UInt8*)packet)[i]);
@@ -122,6 +132,71 @@ bool REACDataStream::gotPacket(const REACPacketHeader *packet, const EthernetHea
     return false;
 }
 
+void REACDataStream::getTopology(REACTopology *topologyCopy) const {
+    UInt32 sequence;
+    do {
+        while ((sequence = topologySequence) & 1) {
+            // Being written
+        }
+        __sync_synchronize();
+        memcpy(topologyCopy, &topology, sizeof(topology));
+        __sync_synchronize();
+    } while (sequence != topologySequence);
+}
+
+void REACDataStream::gotChannelInfo(const REACPacketHeader *packet) {
+    // Each channel info packet has information about 8 channels, 3 bytes each: Channel
+    // number, flags and gain. Channel number 0xfe ends a round.
+    const UInt8 *channelData = packet->data+REAC_STREAM_CONTROL_PACKET_TYPE_SIZE;
+    
+    for (int i=0; i<8; i++) {
+        const UInt8 number = channelData[i*3+0];
+        if (0xfe == number) {
+            // The first round after connecting is joined halfway, so it is incomplete
+            if (assemblingFullRound) {
+                publishTopology();
+            }
+            // Channels that are not listed in the next round are not there anymore
+            memset(assemblingTopology.channels, 0, sizeof(assemblingTopology.channels));
+            assemblingFullRound = true;
+        }
+        else if (number < REAC_TOPOLOGY_MAX_CHANNELS) {
+            assemblingTopology.channels[number].flags = channelData[i*3+1];
+            assemblingTopology.channels[number].gain = channelData[i*3+2];
+        }
+    }
+}
+
+void REACDataStream::publishTopology() {
+    assemblingTopology.inChannels = 0;
+    assemblingTopology.outChannels = 0;
+    for (int i=0; i<REAC_TOPOLOGY_MAX_CHANNELS; i++) {
+        switch (assemblingTopology.channels[i].flags & REAC_TOPOLOGY_CHANNEL_TYPE_MASK) {
+            case REACTopology::CHANNEL_INPUT:
+                assemblingTopology.inChannels++;
+                break;
+            case REACTopology::CHANNEL_OUTPUT:
+                assemblingTopology.outChannels++;
+                break;
+        }
+    }
+    
+    if (0 != topology.version &&
+        0 == memcmp(assemblingTopology.channels, topology.channels, sizeof(topology.channels))) {
+        return;
+    }
+    assemblingTopology.version = topology.version+1;
+    
+    topologySequence++;
+    __sync_synchronize();
+    memcpy(&topology, &assemblingTopology, sizeof(topology));
+    __sync_synchronize();
+    topologySequence++;
+    
+    IOLog("REACDataStream[%p]::publishTopology(): Topology version %d: %d inputs, %d outputs\n",
+          this, (int) topology.version, (int) topology.inChannels, (int) topology.outChannels);
+}
+
 bool REACDataStream::checkChecksum(const REACPacketHeader *packet) {
     UInt8 expected_checksum = 0;
     for (UInt32 i=0; i<sizeof(packet->data); i++) {
@@ -38,6 +38,7 @@
 #define REACPacketHeader        com_pereckerdal_driver_REACPacketHeader
 #define REACDataStream          com_pereckerdal_driver_REACDataStream
 #define REACDeviceInfo          com_pereckerdal_driver_REACDeviceInfo
+#define REACTopology            com_pereckerdal_driver_REACTopology
 
 class com_pereckerdal_driver_REACConnection;
 
@@ -47,6 +48,29 @@ struct REACDeviceInfo {
     UInt32 out_channels;
 };
 
+// The channel layout of the REAC network, as described by the channel info control
+// packets. A new version is made each time a complete round of channel info packets
+// turns out to differ from the previous one.
+#define REAC_TOPOLOGY_MAX_CHANNELS 48
+struct REACTopology {
+    enum ChannelType {
+        CHANNEL_OUTPUT = 0x10,
+        CHANNEL_INPUT = 0x20,
+        CHANNEL_NONE = 0x30
+    };
+#   define REAC_TOPOLOGY_CHANNEL_TYPE_MASK 0x30
+    
+    struct Channel {
+        UInt8 flags; // Channel type (see REAC_TOPOLOGY_CHANNEL_TYPE_MASK). The other bits are not understood, but are believed to include phantom power
+        UInt8 gain;
+    };
+    
+    UInt32  version; // 0 until the first complete round of channel info has been seen
+    UInt32  inChannels;
+    UInt32  outChannels;
+    Channel channels[REAC_TOPOLOGY_MAX_CHANNELS];
+};
+
 /* REAC packet header */
 struct REACPacketHeader {
     UInt8 counter[2];
@@ -62,6 +86,20 @@ struct REACPacketHeader {
         counter[0] = c;
         counter[1] = c >> 8;
     }
+    
+    // Extends the 16 bit packet counter to 64 bits, so that it never wraps. reference
+    // is the extended counter of a recently seen packet. The difference is interpreted
+    // as signed, which means that packets up to half a counter period early or late
+    // are placed correctly.
+    UInt64 getExtendedCounter(UInt64 reference) const {
+        const UInt16 c = counter[0] + (((UInt16) counter[1]) << 8);
+        const SInt64 delta = (SInt16) (c - (UInt16) reference);
+        if (delta < 0 && (UInt64) -delta > reference) {
+            // The reference is within the first counter period
+            return c;
+        }
+        return reference + delta;
+    }
 };
 
 // Handles the data stream part of a REAC stream (both input and output).
@@ -131,12 +169,34 @@ public:
     // return true.
     virtual bool gotPacket(const REACPacketHeader *packet, const EthernetHeader *header);
     
+    // Makes the next packet that is prepared by processPacket get the given counter.
+    void setNextCounter(UInt64 nextCounter) { counter = nextCounter-1; }
+    // The counter of the last packet that was prepared by processPacket.
+    UInt64 getCounter() const { return counter; }
+    UInt64 getChecksumErrors() const { return checksumErrors; }
+    
+    // Copies the latest topology. This can be called from any thread, and does not
+    // block the thread that receives packets. Nothing in the driver uses the topology
+    // yet; it is decoded for the channel setup code that is to come.
+    void getTopology(REACTopology *topology) const;
+    
 protected:
     
     com_pereckerdal_driver_REACConnection *connection;
     UInt64    lastAnnouncePacket; // The counter of the last announce counter packet
     UInt64    recievedPacketCounter;
+    UInt64    checksumErrors;
     UInt64    counter;
+    
+    // Topology state. The published topology is guarded by a sequence number that is
+    // odd while it is being written.
+    REACTopology           assemblingTopology;
+    bool                   assemblingFullRound; // False until the start of a round has been seen
+    REACTopology           topology;
+    volatile UInt32        topologySequence;
+    
+    void gotChannelInfo(const REACPacketHeader *packet);
+    void publishTopology();
         
     static bool checkChecksum(const REACPacketHeader *packet);
     static UInt8 applyChecksum(REACPacketHeader *packet);
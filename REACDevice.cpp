@@ -102,7 +102,11 @@ bool REACDevice::createProtocolListeners() {
     
     while ((interfaceDict = (OSDictionary*)interfaceIterator->getNextObject())) {
         OSString       *ifname = OSDynamicCast(OSString, interfaceDict->getObject(INTERFACE_NAME_KEY));
+        OSDictionary   *impairmentDict = OSDynamicCast(OSDictionary, interfaceDict->getObject(INTERFACE_IMPAIRMENT_KEY));
+        OSNumber       *reorderWindow = OSDynamicCast(OSNumber, interfaceDict->getObject(INTERFACE_REORDER_WINDOW_KEY));
+        OSNumber       *spinBudget = OSDynamicCast(OSNumber, interfaceDict->getObject(INTERFACE_SPIN_BUDGET_KEY));
 		REACConnection *protocol = NULL;
+        IOWorkLoop     *workLoop = NULL;
         ifnet_t interface;
         
         if (NULL == ifname) {
@@ -116,7 +120,18 @@ bool REACDevice::createProtocolListeners() {
             goto Next;
         }
         
-        protocol = REACConnection::withInterface(getWorkLoop(),
+        // Each interface gets a work loop of its own, so that the packets of several
+        // interfaces are processed in parallel on different cores instead of taking
+        // turns on the device's work loop. The connection retains the work loop.
+        workLoop = IOWorkLoop::workLoop();
+        if (NULL == workLoop) {
+            IOLog("REACDevice[%p]::createProtocolListeners() - Error: failed to create work loop for '%s'.\n",
+                  this, ifname->getCStringNoCopy());
+            ifnet_release(interface);
+            goto Next;
+        }
+        
+        protocol = REACConnection::withInterface(workLoop,
                                                  interface,
                                                  REACConnection::REAC_SPLIT,
                                                  &REACDevice::connectionCallback,
@@ -127,6 +142,7 @@ bool REACDevice::createProtocolListeners() {
                                                  16, // inChannels (in REAC_MASTER mode)
                                                  8); // outChannels (in REAC_MASTER mode)
         ifnet_release(interface);
+        workLoop->release();
         
         if (NULL == protocol) {
             IOLog("REACDevice[%p]::createProtocolListeners() - Error: failed to initialize REAC listener for '%s'.\n",
@@ -134,6 +150,27 @@ bool REACDevice::createProtocolListeners() {
             goto Next;
         }
         
+        if (NULL != reorderWindow) {
+            protocol->setReorderWindow(reorderWindow->unsigned32BitValue());
+        }
+        
+        if (NULL != spinBudget) {
+            protocol->setSpinBudget(spinBudget->unsigned32BitValue());
+        }
+        
+        if (NULL != impairmentDict) {
+            REACImpairment *impairment = REACImpairment::withProfile(impairmentDict);
+            if (NULL == impairment) {
+                IOLog("REACDevice[%p]::createProtocolListeners() - Error: invalid impairment profile for '%s'.\n",
+                      this, ifname->getCStringNoCopy());
+                goto Next;
+            }
+            IOLog("REACDevice[%p]::createProtocolListeners(): Impairing incoming packets on '%s'.\n",
+                  this, ifname->getCStringNoCopy());
+            protocol->setImpairment(impairment);
+            impairment->release();
+        }
+        
         if (!protocol->start()) {
             IOLog("REACDevice[%p]::createProtocolListeners() - Error: failed to listen to '%s'.\n",
                   this, ifname->getCStringNoCopy());
@@ -160,7 +197,9 @@ void REACDevice::connectionCallback(REACConnection *proto, void **cookieA, void*
     REACDevice *device = (REACDevice*) *cookieA;
 
     if (NULL == *cookieB) {
-        *cookieB = (void*) device->createAudioEngine(proto);
+        // This runs on the connection's work loop, so the device's state has to be
+        // guarded by the device's command gate.
+        device->getCommandGate()->runAction(&REACDevice::createAudioEngineAction, proto, cookieB);
     }
     return; // TODO Debug
     
@@ -179,16 +218,16 @@ void REACDevice::connectionCallback(REACConnection *proto, void **cookieA, void*
     else {
         // IOLog("REACDevice[%p]::connectionCallback() - Connected.\n", device);
         
-        *cookieB = (void*) device->createAudioEngine(proto);
+        device->getCommandGate()->runAction(&REACDevice::createAudioEngineAction, proto, cookieB);
     }
 }
 
-void REACDevice::samplesCallback(REACConnection *proto, void **cookieA, void** cookieB, UInt8 **data, UInt32 *bufferSize) {
+void REACDevice::samplesCallback(REACConnection *proto, void **cookieA, void** cookieB, SInt32 packetOffset, UInt8 **data, UInt32 *bufferSize) {
     // IOLog("REACDevice[%p]::samplesCallback()\n", *cookieA);
     
     REACAudioEngine *engine = (REACAudioEngine *)*cookieB;
     if (NULL != engine) {
-        engine->gotSamples(data, bufferSize);
+        engine->gotSamples(packetOffset, data, bufferSize);
     }
 }
 
@@ -201,6 +240,15 @@ void REACDevice::getSamplesCallback(REACConnection *proto, void **cookieA, void*
     }
 }
 
+IOReturn REACDevice::createAudioEngineAction(OSObject *owner, void *proto, void *engine, void*, void*) {
+    REACDevice *device = OSDynamicCast(REACDevice, owner);
+    if (NULL == device) {
+        return kIOReturnBadArgument;
+    }
+    *(REACAudioEngine **)engine = device->createAudioEngine((REACConnection *)proto);
+    return kIOReturnSuccess;
+}
+
 REACAudioEngine* REACDevice::createAudioEngine(REACConnection *proto) {
     OSDictionary *originalAudioEngineParams = OSDynamicCast(OSDictionary, getProperty(AUDIO_ENGINE_PARAMS_KEY));
     OSDictionary *audioEngineParams = NULL;
@@ -263,6 +311,9 @@ Done:
 IOReturn REACDevice::performPowerStateChange(IOAudioDevicePowerState oldPowerState, 
                                              IOAudioDevicePowerState newPowerState, 
                                              UInt32 *microsecondsUntilComplete) {
-    // TODO
+    // There is no hardware to power down. The connections go idle by themselves when
+    // their engines are stopped and no peer is sending (see REACConnection::setInUse),
+    // which is what happens when IOAudioFamily moves the device to idle or sleep.
+    IOLog("REACDevice[%p]::performPowerStateChange(): %d -> %d\n", this, (int) oldPowerState, (int) newPowerState);
     return kIOReturnSuccess;
 }
@@ -33,6 +33,9 @@
 #define AUDIO_ENGINE_PARAMS_KEY         "AudioEngineParams"
 #define INTERFACES_KEY                  "Interfaces"
 #define INTERFACE_NAME_KEY              "Name"
+#define INTERFACE_IMPAIRMENT_KEY        "Impairment"
+#define INTERFACE_REORDER_WINDOW_KEY    "ReorderWindow"
+#define INTERFACE_SPIN_BUDGET_KEY       "SpinBudget"
 #define DESCRIPTION_KEY                 "Description"
 #define BLOCK_SIZE_KEY                  "BlockSize"
 #define NUM_BLOCKS_KEY                  "NumBlocks"
@@ -65,8 +68,9 @@ class REACDevice : public IOAudioDevice
     virtual void free();
     virtual bool createProtocolListeners();
     static void connectionCallback(REACConnection *proto, void **cookieA, void** cookieB, REACDeviceInfo *device);
-    static void samplesCallback(REACConnection *proto, void **cookieA, void** cookieB, UInt8 **data, UInt32 *bufferSize);
+    static void samplesCallback(REACConnection *proto, void **cookieA, void** cookieB, SInt32 packetOffset, UInt8 **data, UInt32 *bufferSize);
     static void getSamplesCallback(REACConnection *proto, void **cookieA, void** cookieB, UInt8 **data, UInt32 *bufferSize);
+    static IOReturn createAudioEngineAction(OSObject *owner, void *proto, void *engine, void*, void*);
     virtual REACAudioEngine* createAudioEngine(REACConnection *proto);
     virtual IOReturn performPowerStateChange(IOAudioDevicePowerState oldPowerState, 
                                              IOAudioDevicePowerState newPowerState,
@@ -0,0 +1,161 @@
+/*
+ *  REACImpairment.cpp
+ *  REAC
+ *
+ *  Copyright 2011 Per Eckerdal. All rights reserved.
+ *  
+ *  
+ *  This file is part of the OS X REAC driver.
+ *  
+ *  The OS X REAC driver is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, either version 3 of
+ *  the License, or (at your option) any later version.
+ *  
+ *  The OS X REAC driver is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with OS X REAC driver.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "REACImpairment.h"
+
+#include <IOKit/IOLib.h>
+#include <libkern/c++/OSNumber.h>
+
+OSDefineMetaClassAndStructors(REACImpairment, OSObject)
+
+bool REACImpairment::initWithProfile(OSDictionary *profile) {
+    if (NULL == profile || !OSObject::init()) {
+        return false;
+    }
+    
+    goodToBad = profileValue(profile, "GoodToBad", 0);
+    badToGood = profileValue(profile, "BadToGood", 1000000);
+    lossGood = profileValue(profile, "LossGood", 0);
+    lossBad = profileValue(profile, "LossBad", 1000000);
+    duplicate = profileValue(profile, "Duplicate", 0);
+    delay = profileValue(profile, "Delay", 0);
+    maxDelay = profileValue(profile, "MaxDelay", 1);
+    if (maxDelay < 1) {
+        maxDelay = 1;
+    }
+    
+    // xorshift can't have a zero state
+    randomState = profileValue(profile, "Seed", 1);
+    if (0 == randomState) {
+        randomState = 1;
+    }
+    
+    badState = false;
+    numHeld = 0;
+    packets = 0;
+    lostPackets = 0;
+    duplicatedPackets = 0;
+    delayedPackets = 0;
+    delayedPacketPeriods = 0;
+    
+    return true;
+}
+
+void REACImpairment::free() {
+    flush();
+    OSObject::free();
+}
+
+REACImpairment *REACImpairment::withProfile(OSDictionary *profile) {
+    REACImpairment *i = new REACImpairment;
+    if (NULL == i) return NULL;
+    bool result = i->initWithProfile(profile);
+    if (!result) {
+        i->release();
+        return NULL;
+    }
+    return i;
+}
+
+UInt32 REACImpairment::admit(mbuf_t mbuf, const EthernetHeader *header) {
+    ++packets;
+    
+    if (badState ? chance(badToGood) : chance(goodToBad)) {
+        badState = !badState;
+    }
+    
+    if (chance(badState ? lossBad : lossGood)) {
+        ++lostPackets;
+        return 0;
+    }
+    
+    if (numHeld < REAC_IMPAIRMENT_MAX_HELD_PACKETS && chance(delay)) {
+        // The packet that is passed in is freed by the network stack when it has been
+        // processed, so a held back packet has to be a copy.
+        mbuf_t copy;
+        if (0 != mbuf_dup(mbuf, MBUF_DONTWAIT, &copy)) {
+            return 1;
+        }
+        
+        const UInt32 periods = 1 + random() % maxDelay;
+        HeldPacket *hp = &held[numHeld++];
+        hp->mbuf = copy;
+        memcpy(&hp->header, header, sizeof(hp->header));
+        hp->releaseAt = packets+periods;
+        
+        ++delayedPackets;
+        delayedPacketPeriods += periods;
+        return 0;
+    }
+    
+    if (chance(duplicate)) {
+        ++duplicatedPackets;
+        return 2;
+    }
+    
+    return 1;
+}
+
+bool REACImpairment::takeDuePacket(mbuf_t *mbuf, EthernetHeader *header) {
+    for (UInt32 i=0; i<numHeld; i++) {
+        if (held[i].releaseAt <= packets) {
+            *mbuf = held[i].mbuf;
+            memcpy(header, &held[i].header, sizeof(*header));
+            
+            held[i] = held[--numHeld];
+            return true;
+        }
+    }
+    return false;
+}
+
+void REACImpairment::flush() {
+    for (UInt32 i=0; i<numHeld; i++) {
+        mbuf_freem(held[i].mbuf);
+    }
+    numHeld = 0;
+}
+
+void REACImpairment::logStatistics(const void *owner) const {
+    IOLog("REACImpairment[%p]: %lld packets, %lld lost, %lld duplicated, %lld delayed by %lld packet periods in total\n",
+          owner, packets, lostPackets, duplicatedPackets, delayedPackets, delayedPacketPeriods);
+}
+
+UInt32 REACImpairment::profileValue(OSDictionary *profile, const char *key, UInt32 defaultValue) {
+    OSNumber *number = OSDynamicCast(OSNumber, profile->getObject(key));
+    return number ? number->unsigned32BitValue() : defaultValue;
+}
+
+UInt32 REACImpairment::random() {
+    // xorshift32
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+bool REACImpairment::chance(UInt32 ppm) {
+    return 0 != ppm && random() % 1000000 < ppm;
+}
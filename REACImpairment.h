@@ -0,0 +1,115 @@
+/*
+ *  REACImpairment.h
+ *  REAC
+ *
+ *  Copyright 2011 Per Eckerdal. All rights reserved.
+ *  
+ *  
+ *  This file is part of the OS X REAC driver.
+ *  
+ *  The OS X REAC driver is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, either version 3 of
+ *  the License, or (at your option) any later version.
+ *  
+ *  The OS X REAC driver is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with OS X REAC driver.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _REACIMPAIRMENT_H
+#define _REACIMPAIRMENT_H
+
+#include <libkern/OSTypes.h>
+#include <libkern/c++/OSObject.h>
+#include <libkern/c++/OSDictionary.h>
+#include <sys/kpi_mbuf.h>
+
+#include "EthernetHeader.h"
+
+#define REACImpairment          com_pereckerdal_driver_REACImpairment
+
+#define REAC_IMPAIRMENT_MAX_HELD_PACKETS 16
+
+// Deliberately degrades the stream of incoming packets before it reaches the REAC
+// processing, so that it is possible to test how the driver copes with bad networks
+// in a repeatable way. It is configured with the Impairment dictionary of an entry
+// in the Interfaces array in Info.plist. Probabilities are in parts per million.
+//
+//   Seed       Seed of the random number generator. Same seed, same impairments.
+//   GoodToBad  Probability of going from the good to the bad state (Gilbert-Elliott)
+//   BadToGood  Probability of going from the bad to the good state
+//   LossGood   Probability that a packet is lost in the good state
+//   LossBad    Probability that a packet is lost in the bad state
+//   Duplicate  Probability that a packet is delivered twice
+//   Delay      Probability that a packet is held back
+//   MaxDelay   The maximum number of packets that a packet is held back
+//
+// A packet that is held back is delivered after a random number (1 to MaxDelay) of
+// later packets, so delay is measured in packet periods and delayed packets arrive
+// out of order.
+//
+// This class is not thread safe.
+class REACImpairment : public OSObject {
+    OSDeclareFinalStructors(REACImpairment);
+    
+public:
+    virtual bool initWithProfile(OSDictionary *profile);
+    static REACImpairment *withProfile(OSDictionary *profile);
+    
+    // Returns the number of times the packet should be processed right away: 0 if it
+    // was lost or held back, 1 normally and 2 if it was duplicated. Held back packets
+    // are fetched with takeDuePacket. The caller keeps ownership of mbuf; a held back
+    // packet is a copy of it.
+    UInt32 admit(mbuf_t mbuf, const EthernetHeader *header);
+    // Fetches a held back packet that is due. Returns false when there is none. The
+    // caller takes ownership of *mbuf, and has to free it with mbuf_freem.
+    bool takeDuePacket(mbuf_t *mbuf, EthernetHeader *header);
+    // Frees the packets that are held back without delivering them.
+    void flush();
+    
+    void logStatistics(const void *owner) const;
+    
+protected:
+    struct HeldPacket {
+        mbuf_t          mbuf;
+        EthernetHeader  header;
+        UInt64          releaseAt; // Value of packets when the packet is to be delivered
+    };
+    
+    // Profile
+    UInt32      goodToBad;
+    UInt32      badToGood;
+    UInt32      lossGood;
+    UInt32      lossBad;
+    UInt32      duplicate;
+    UInt32      delay;
+    UInt32      maxDelay;
+    
+    // State
+    UInt32      randomState;
+    bool        badState;
+    HeldPacket  held[REAC_IMPAIRMENT_MAX_HELD_PACKETS];
+    UInt32      numHeld;
+    
+    // Statistics
+    UInt64      packets;
+    UInt64      lostPackets;
+    UInt64      duplicatedPackets;
+    UInt64      delayedPackets;
+    UInt64      delayedPacketPeriods; // Sum of the delays of all delayed packets
+    
+    virtual void free();
+    
+    static UInt32 profileValue(OSDictionary *profile, const char *key, UInt32 defaultValue);
+    UInt32 random();
+    bool chance(UInt32 ppm);
+};
+
+#endif
@@ -65,6 +65,8 @@ bool REACMasterDataStream::initConnection(REACConnection *conn) {
     cdeaState = 0;
     cdeaPacketsSinceStateChange = -1;
     cdeaAtChannel = 0;
+    memset(channelGains, 0, sizeof(channelGains));
+    pendingChannelInfoGroups = 0;
     
     splitUnits = OSArray::withCapacity(10);
     if (NULL == splitUnits) {
@@ -181,6 +183,26 @@ IOReturn REACMasterDataStream::processPacket(REACPacketHeader *packet, UInt32 dh
         
         disconnectObsoleteSplitUnits();
     }
+    else if (0 != pendingChannelInfoGroups) {
+        // Channel info that has been changed through the API is sent right away, without
+        // disturbing the cdea state machine below.
+        UInt32 group = 0;
+        while (!(pendingChannelInfoGroups & (1 << group))) {
+            group++;
+        }
+        pendingChannelInfoGroups &= ~(1 << group);
+        
+        UInt8 *payload = packet->data+REAC_STREAM_CONTROL_PACKET_TYPE_SIZE;
+        memset(payload, 0, sizeof(packet->data)-REAC_STREAM_CONTROL_PACKET_TYPE_SIZE);
+        for (int i=0; i<8; i++) {
+            writeChannelInfoEntry(payload+i*3, group*8+i);
+        }
+        
+        setPacketTypeMacro(REAC_STREAM_CONTROL);
+        memcpy(packet->data, REAC_STREAM_CONTROL_PACKET_TYPE[CONTROL_PACKET_TYPE_THREE], REAC_STREAM_CONTROL_PACKET_TYPE_SIZE);
+        
+        applyChecksumAndSaveLastChecksumMacro();
+    }
     else if (0 >= packetsUntilNextCdea) {
         /// It is more or less impossible to read this code and understand what it does.
         /// It is because I don't understand it either. It basically attempts to output
@@ -290,32 +312,7 @@ IOReturn REACMasterDataStream::processPacket(REACPacketHeader *packet, UInt32 dh
             case 2: // Channel info state
                 cdeaPacketType = 2;
                 for (int i=0; i<8; i++) {
-                    // The first byte of the channel data is the channel number
-                    if (cdeaAtChannel == 48) {
-                        payload[i*3+0] = 0xfe;
-                    }
-                    else {
-                        payload[i*3+0] = cdeaAtChannel;
-                    }
-                    
-                    // The second byte of the channel data seems to contain channel type flags
-                    // (input/output/none/terminator type + phantom)
-                    if (cdeaAtChannel == 48) {
-                        payload[i*3+1] = 0x01;
-                    }
-                    else if (cdeaAtChannel < connection->getInChannels()) {
-                        payload[i*3+1] = 0x20;
-                    }
-                    else if (cdeaAtChannel < connection->getInChannels()+connection->getOutChannels()) {
-                        payload[i*3+1] = 0x10;
-                    }
-                    else {
-                        payload[i*3+1] = 0x30;
-                    }
-                    
-                    // The third byte of the channel data is gain
-                    payload[i*3+2] = 0x00;
-                    
+                    writeChannelInfoEntry(payload+i*3, cdeaAtChannel);
                     cdeaAtChannel = (cdeaAtChannel+1)%49;
                 }
                 memset(payload+PAYLOAD_SIZE-2, 0, 2);
@@ -419,6 +416,44 @@ IOReturn REACMasterDataStream::processPacket(REACPacketHeader *packet, UInt32 dh
     return kIOReturnSuccess;
 }
 
+void REACMasterDataStream::writeChannelInfoEntry(UInt8 *entry, SInt32 channel) {
+    // The first byte of the channel data is the channel number
+    if (channel == 48) {
+        entry[0] = 0xfe;
+    }
+    else {
+        entry[0] = channel;
+    }
+    
+    // The second byte of the channel data seems to contain channel type flags
+    // (input/output/none/terminator type + phantom)
+    if (channel == 48) {
+        entry[1] = 0x01;
+    }
+    else if (channel < connection->getInChannels()) {
+        entry[1] = 0x20;
+    }
+    else if (channel < connection->getInChannels()+connection->getOutChannels()) {
+        entry[1] = 0x10;
+    }
+    else {
+        entry[1] = 0x30;
+    }
+    
+    // The third byte of the channel data is gain
+    entry[2] = (channel < REAC_TOPOLOGY_MAX_CHANNELS) ? channelGains[channel] : 0x00;
+}
+
+IOReturn REACMasterDataStream::setChannelGain(UInt32 channel, UInt8 gain) {
+    if (channel >= REAC_TOPOLOGY_MAX_CHANNELS) {
+        return kIOReturnBadArgument;
+    }
+    
+    channelGains[channel] = gain;
+    pendingChannelInfoGroups |= 1 << (channel/8);
+    return kIOReturnSuccess;
+}
+
 bool REACMasterDataStream::gotPacket(const REACPacketHeader *packet, const EthernetHeader *header) {
     if (super::gotPacket(packet, header)) {
         return true;
@@ -70,6 +70,11 @@ public:
     
     bool isConnectedToSlave() const;
     
+    // Sets the gain byte that is sent in the channel info for a channel. The change
+    // is sent in the next packet that isn't needed for the handshakes, ahead of the
+    // regular cdea packets. Has to be called on the connection's work loop.
+    IOReturn setChannelGain(UInt32 channel, UInt8 gain);
+    
 protected:
     enum GotSplitAnnounceState {
         GOT_SPLIT_NOT_INITIATED,
@@ -91,6 +96,10 @@ protected:
     SInt32    cdeaPacketsSinceStateChange;
     SInt32    cdeaAtChannel;     // Used when writing the cdea channel info packets
     SInt32    cdeaCurrentOffset; // Used when writing the cdea filler packets
+    UInt8     channelGains[REAC_TOPOLOGY_MAX_CHANNELS];
+    UInt8     pendingChannelInfoGroups; // Bit n is set when channels n*8 to n*8+7 have changed and are to be sent
+    
+    void writeChannelInfoEntry(UInt8 *entry, SInt32 channel);
     
     // Slave handshake state
     enum SlaveConnectionStatus {